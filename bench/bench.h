@@ -0,0 +1,128 @@
+#ifndef BENCHH
+#define BENCHH
+
+/* Helpers shared by the bench/ programs.
+ *
+ * Every result is one JSON object per line on stdout so runs can be
+ * diffed or loaded by a script.  Each case runs in a forked child:
+ * the library keeps process-wide state and main can only be started
+ * once, and this also keeps peak-RSS numbers independent.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+static inline double now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static inline long maxrss_kb(void){
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+// Resident set right now (maxrss only ever grows)
+static inline long rss_kb(void){
+  long size, res = -1;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f){
+    if (fscanf(f, "%ld %ld", &size, &res) != 2) res = -1;
+    fclose(f);
+  }
+  return res < 0 ? -1 : res * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static inline double cpu_ns(void){
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e9 +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e3;
+}
+
+// A hardware counter for the calling thread, or -1 (e.g. inside a VM)
+static inline int hw_event(unsigned type, unsigned long config){
+  struct perf_event_attr a;
+  memset(&a, 0, sizeof a);
+  a.size = sizeof a;
+  a.type = type;
+  a.config = config;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+static inline int hw_counter(unsigned long config){
+  return hw_event(PERF_TYPE_HARDWARE, config);
+}
+
+static inline int dtlb_miss_counter(void){
+  return hw_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static inline long hw_read(int fd){
+  long v = 0;
+  if (fd < 0 || read(fd, &v, sizeof v) != (ssize_t)sizeof v) return -1;
+  return v;
+}
+
+// ,"<name>_per_op":x  -- or null when the counter isn't available
+static inline void per_op_field(char *buf, size_t len, const char *name,
+                                long delta, long ops){
+  if (delta < 0 || !ops) snprintf(buf, len, "\"%s_per_op\":null", name);
+  else snprintf(buf, len, "\"%s_per_op\":%.3f", name, (double)delta / (double)ops);
+}
+
+// {"bench":..,"impl":..,"threads":..,"ops":..,"ns_per_op":..[,extra]}
+static inline void report(const char *bench, const char *impl, long threads,
+                          long ops, double ns, const char *extra){
+  printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"threads\":%ld,\"ops\":%ld,"
+         "\"ns_per_op\":%.2f%s%s}\n",
+         bench, impl, threads, ops, ops ? ns / (double)ops : 0.0,
+         extra ? "," : "", extra ? extra : "");
+  fflush(stdout);
+}
+
+static inline void report_skip(const char *bench, const char *impl,
+                               long threads, const char *why){
+  printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"threads\":%ld,"
+         "\"skipped\":\"%s\"}\n", bench, impl, threads, why);
+  fflush(stdout);
+}
+
+// Refuse cases that would need more than half the free memory
+static inline int fits_in_memory(long threads, long bytes_each){
+  double avail = (double)sysconf(_SC_AVPHYS_PAGES) * (double)sysconf(_SC_PAGESIZE);
+  return (double)threads * (double)bytes_each < avail / 2;
+}
+
+// Optional substring filter on case names (argv[1] of each program)
+static const char *bench_filter = NULL;
+
+// Run fn(arg) in a child process and wait for it
+static inline void in_child(void (*fn)(long), long arg){
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0){ fn(arg); fflush(stdout); _exit(0); }
+  if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+#define RUN(name, fn, arg) \
+  do { if (!bench_filter || strstr(name, bench_filter)) in_child(fn, arg); } while (0)
+
+static inline long env_long(const char *name, long dflt){
+  const char *v = getenv(name);
+  return v ? atol(v) : dflt;
+}
+
+#endif
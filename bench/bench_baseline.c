@@ -0,0 +1,95 @@
+// bench_baseline.c: the same operations with ucontext and pthreads
+#include "bench.h"
+#include <pthread.h>
+#include <ucontext.h>
+
+#define UC_STACK (64 * 1024)
+
+/* ---------- ucontext ---------- */
+static ucontext_t uc_main, uc_co;
+static long uc_rounds;
+
+static void uc_body(void){
+  for(long i=0;i<uc_rounds;i++) swapcontext(&uc_co, &uc_main);
+}
+
+static void uc_pingpong(long n){
+  char *stk = malloc(UC_STACK);
+  uc_rounds = n;
+  getcontext(&uc_co);
+  uc_co.uc_stack.ss_sp = stk;
+  uc_co.uc_stack.ss_size = UC_STACK;
+  uc_co.uc_link = &uc_main;
+  makecontext(&uc_co, uc_body, 0);
+
+  double t0 = now_ns();
+  for(long i=0;i<=n;i++) swapcontext(&uc_main, &uc_co);
+  report("yield_pingpong", "ucontext", 2, 2 * n, now_ns() - t0, NULL);
+  free(stk);
+}
+
+static void uc_nop(void){ }
+
+static void uc_create(long n){
+  double t0 = now_ns();
+  for(long i=0;i<n;i++){
+    ucontext_t c;
+    char *stk = malloc(UC_STACK);
+    getcontext(&c);
+    c.uc_stack.ss_sp = stk;
+    c.uc_stack.ss_size = UC_STACK;
+    c.uc_link = &uc_main;
+    makecontext(&c, uc_nop, 0);
+    swapcontext(&uc_main, &c);
+    free(stk);
+  }
+  report("create_exit_wait", "ucontext", 1, n, now_ns() - t0, NULL);
+}
+
+/* ---------- pthreads ---------- */
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cv = PTHREAD_COND_INITIALIZER;
+static int turn = 0;
+
+static void *pp_body(void *p){
+  long me = (long)p & 1, n = (long)p >> 1;
+  for(long i=0;i<n;i++){
+    pthread_mutex_lock(&mu);
+    while(turn != me) pthread_cond_wait(&cv, &mu);
+    turn = !me;
+    pthread_cond_signal(&cv);
+    pthread_mutex_unlock(&mu);
+  }
+  return NULL;
+}
+
+static void pt_pingpong(long n){
+  pthread_t a, b;
+  double t0 = now_ns();
+  pthread_create(&a, NULL, pp_body, (void*)(n << 1 | 0));
+  pthread_create(&b, NULL, pp_body, (void*)(n << 1 | 1));
+  pthread_join(a, NULL);
+  pthread_join(b, NULL);
+  report("yield_pingpong", "pthread", 2, 2 * n, now_ns() - t0, NULL);
+}
+
+static void *pt_nop(void *p){ return p; }
+
+static void pt_create(long n){
+  double t0 = now_ns();
+  for(long i=0;i<n;i++){
+    pthread_t t;
+    pthread_create(&t, NULL, pt_nop, NULL);
+    pthread_join(t, NULL);
+  }
+  report("create_exit_wait", "pthread", 1, n, now_ns() - t0, NULL);
+}
+
+int main(int argc, char *argv[]){
+  if(argc > 1) bench_filter = argv[1];
+  RUN("create_exit_wait", uc_create,   env_long("BENCH_CREATES", 100000));
+  RUN("yield_pingpong",   uc_pingpong, env_long("BENCH_PINGPONG", 1000000));
+  RUN("create_exit_wait", pt_create,   env_long("BENCH_CREATES", 100000) / 10);
+  RUN("yield_pingpong",   pt_pingpong, env_long("BENCH_PINGPONG", 1000000) / 10);
+  return 0;
+}
@@ -0,0 +1,719 @@
+// bench_lwp.c: core LWP costs (create/exit/wait, yield, migration, RSS)
+#include "bench.h"
+#include "lwp.h"
+#include <alloca.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define STACK_TOUCH (16 * 1024)   // generous per-thread RSS estimate
+
+static int nop(void *p){ (void)p; return 0; }
+
+static int yielder(void *p){
+  for(long i=0;i<(long)p;i++) lwp_yield();
+  return 0;
+}
+
+static void drain(void){
+  while(lwp_wait(NULL) != NO_THREAD) ;
+}
+
+/* ---------- create + exit + wait ---------- */
+static void create_exit_wait(long n){
+  double t0 = now_ns();
+  for(long i=0;i<n;i++){
+    lwp_create(nop, NULL);
+    lwp_wait(NULL);
+  }
+  report("create_exit_wait", "lwp", 1, n, now_ns() - t0, NULL);
+}
+
+/* ---------- two threads yielding to each other ---------- */
+static void yield_pingpong(long n){
+  lwp_create(yielder, (void*)n);
+  lwp_create(yielder, (void*)n);
+  double t0 = now_ns();
+  drain();
+  report("yield_pingpong", "lwp", 2, 2 * n, now_ns() - t0, NULL);
+}
+
+/* ---------- the pingpong with the switch tracer on and off ----------
+ * Best of TRACE_REPS runs each way, interleaved so drift hits both,
+ * with a ring of `ring` events that wraps, as a flight recorder does.
+ * What tracing costs past the stores is the ring's cache footprint.
+ */
+#define TRACE_REPS 5
+
+static double pingpong_ns(long n){
+  lwp_create(yielder, (void*)n);
+  lwp_create(yielder, (void*)n);
+  double t0 = now_ns();
+  drain();
+  return now_ns() - t0;
+}
+
+static void trace_overhead(long ring){
+  long n = env_long("BENCH_PINGPONG", 1000000);
+  double off = 0, on = 0;
+  for(int r=0;r<TRACE_REPS;r++){
+    double el = pingpong_ns(n);
+    if(!r || el < off) off = el;
+    if(lwp_trace_start((size_t)ring)) return;
+    el = pingpong_ns(n);
+    lwp_trace_stop();
+    if(!r || el < on) on = el;
+  }
+  char extra[96];
+  snprintf(extra, sizeof extra, "\"ring\":%ld,\"off_ns_per_op\":%.2f,\"overhead_pct\":%.1f",
+           ring, off / (double)(2 * n), 100.0 * (on - off) / off);
+  report("trace_overhead", "on", 2, 2 * n, on, extra);
+}
+
+/* ---------- yield throughput with many runnable threads ---------- */
+static void yield_throughput(long threads){
+  if(!fits_in_memory(threads, STACK_TOUCH)){
+    report_skip("yield_throughput", "lwp", threads, "not enough memory");
+    return;
+  }
+  long budget = env_long("BENCH_YIELDS", 2000000);
+  long each = budget / threads > 2 ? budget / threads : 2;
+
+  double c0 = now_ns();
+  for(long i=0;i<threads;i++){
+    if(lwp_create(yielder, (void*)each) == NO_THREAD){
+      char why[64];
+      snprintf(why, sizeof why, "create failed at %ld", i);
+      report_skip("yield_throughput", "lwp", threads, why);
+      return;
+    }
+  }
+  int fd = hw_counter(PERF_COUNT_HW_CACHE_MISSES);
+  long m0 = hw_read(fd);
+  double t0 = now_ns();
+  drain();
+  double t1 = now_ns();
+  long m1 = hw_read(fd);
+
+  char misses[64], extra[160];
+  per_op_field(misses, sizeof misses, "cache_misses",
+               m0 < 0 || m1 < 0 ? -1 : m1 - m0, threads * each);
+  snprintf(extra, sizeof extra, "\"create_ns_per_thread\":%.2f,%s",
+           (t0 - c0) / (double)threads, misses);
+  report("yield_throughput", "lwp", threads, threads * each, t1 - t0, extra);
+}
+
+/* ---------- starting a big batch of threads ---------- */
+static void startup_loop(long threads){
+  if(!fits_in_memory(threads, STACK_TOUCH)){
+    report_skip("startup", "lwp_create", threads, "not enough memory");
+    return;
+  }
+  double t0 = now_ns();
+  long i;
+  for(i=0;i<threads;i++)
+    if(lwp_create(nop, NULL) == NO_THREAD) break;
+  double el = now_ns() - t0;
+  char extra[48];
+  snprintf(extra, sizeof extra, "\"created\":%ld", i);
+  report("startup", "lwp_create", threads, i, el, extra);
+}
+
+static void startup_many(long threads){
+  if(!fits_in_memory(threads, STACK_TOUCH)){
+    report_skip("startup", "lwp_create_many", threads, "not enough memory");
+    return;
+  }
+  void **args = calloc(threads, sizeof *args);
+  double t0 = now_ns();
+  size_t got = lwp_create_many(nop, args, threads, NULL);
+  double el = now_ns() - t0;
+  char extra[48];
+  snprintf(extra, sizeof extra, "\"created\":%zu", got);
+  report("startup", "lwp_create_many", threads, (long)got, el, extra);
+}
+
+/* ---------- reaping exited threads: lwp_wait vs lwp_wait_many ---------- */
+static void reap(long which){
+  long threads = which / 2, many = which % 2;
+  if(!fits_in_memory(threads, STACK_TOUCH)){
+    report_skip("reap", many ? "lwp_wait_many" : "lwp_wait", threads, "not enough memory");
+    return;
+  }
+  void **args = calloc(threads, sizeof *args);
+  tid_t *tids = malloc(threads * sizeof *tids);
+  int *st = malloc(threads * sizeof *st);
+  size_t made = lwp_create_many(nop, args, threads, NULL);
+  lwp_wait_many(tids, st, 1, 0);         // runs them all; they all exit
+
+  long got = 1;
+  double t0 = now_ns();
+  if(many){
+    size_t k;
+    while((k = lwp_wait_many(tids, st, 4096, LWP_WNOHANG)) > 0) got += (long)k;
+  } else {
+    while(lwp_wait(NULL) != NO_THREAD) got++;
+  }
+  double el = now_ns() - t0;
+  char extra[48];
+  snprintf(extra, sizeof extra, "\"reaped\":%ld", got);
+  report("reap", many ? "lwp_wait_many" : "lwp_wait", (long)made, got - 1, el, extra);
+}
+
+/* ---------- scheduler migration ---------- */
+// A second scheduler to migrate to: a plain array FIFO
+static thread *fq = NULL;
+static long fq_head = 0, fq_len = 0, fq_cap = 0;
+
+static void fq_init(void){ fq_head = fq_len = 0; }
+static void fq_shutdown(void){ fq_head = fq_len = 0; }
+static void fq_admit(thread t){
+  if(fq_len == fq_cap){
+    long ncap = fq_cap ? 2 * fq_cap : 1024;
+    thread *n = malloc(ncap * sizeof *n);
+    for(long i=0;i<fq_len;i++) n[i] = fq[(fq_head + i) % fq_cap];
+    free(fq); fq = n; fq_cap = ncap; fq_head = 0;
+  }
+  fq[(fq_head + fq_len++) % fq_cap] = t;
+}
+static void fq_remove(thread t){
+  for(long i=0;i<fq_len;i++){
+    if(fq[(fq_head + i) % fq_cap] == t){
+      for(long j=i;j>0;j--) fq[(fq_head + j) % fq_cap] = fq[(fq_head + j - 1) % fq_cap];
+      fq_head = (fq_head + 1) % fq_cap;
+      fq_len--;
+      return;
+    }
+  }
+}
+static thread fq_next(void){
+  if(!fq_len) return NULL;
+  thread t = fq[fq_head];
+  fq_head = (fq_head + 1) % fq_cap;
+  fq_len--;
+  return t;
+}
+static int fq_qlen(void){ return (int)fq_len; }
+static struct scheduler FIFO = { fq_init, fq_shutdown, fq_admit, fq_remove, fq_next, fq_qlen };
+
+static long mig_threads;
+
+static int migrator(void *p){
+  long rounds = (long)p;
+  for(long i=0;i<mig_threads;i++) lwp_create(nop, NULL);
+  double t0 = now_ns();
+  for(long r=0;r<rounds;r++){
+    lwp_set_scheduler(&FIFO);
+    lwp_set_scheduler(NULL);            // back to round robin
+  }
+  double el = now_ns() - t0;
+  char extra[64];
+  snprintf(extra, sizeof extra, "\"ns_per_thread_moved\":%.2f",
+           el / (double)(2 * rounds * mig_threads));
+  report("scheduler_migration", "lwp", mig_threads, 2 * rounds, el, extra);
+  return 0;
+}
+
+static void migration(long threads){
+  mig_threads = threads;
+  lwp_create(migrator, (void*)4);
+  drain();
+}
+
+/* ---------- peak RSS per thread ---------- */
+static void rss_per_thread(long threads){
+  if(!fits_in_memory(threads, STACK_TOUCH)){
+    report_skip("rss_per_thread", "lwp", threads, "not enough memory");
+    return;
+  }
+  long base = maxrss_kb();
+  long made = 0;
+  for(;made<threads;made++)
+    if(lwp_create(yielder, (void*)1) == NO_THREAD) break;
+  drain();
+  long peak = maxrss_kb();
+  char extra[96];
+  snprintf(extra, sizeof extra,
+           "\"created\":%ld,\"bytes_per_thread\":%.0f", made,
+           made ? (double)(peak - base) * 1024.0 / (double)made : 0.0);
+  report("rss_per_thread", "lwp", threads, 0, 0, extra);
+}
+
+/* ---------- shared (copying) stack vs private stacks ----------
+ * SS_THREADS threads each hold `depth` bytes of live stack and yield in
+ * turn.  Shared-stack threads pay two copies of that per switch; private
+ * ones pay a resident stack each.  The sweep reports both per depth and
+ * the first depth at which a shared-stack switch costs more than twice
+ * a private one: there the copies alone take longer than a whole private
+ * switch, so copying, not switching, is what the thread spends its time
+ * on.  All the threads are in one group, so they share one stack.
+ */
+#define SS_THREADS 1000
+static const long ss_depths[] = { 256, 1024, 4096, 16384, 65536 };
+#define SS_NDEPTHS ((long)(sizeof ss_depths / sizeof ss_depths[0]))
+static double *ss_ns;                   // [depth][mode], shared with children
+static long ss_depth, ss_rss0, ss_rss;
+
+static int ss_worker(void *p){
+  volatile char *buf = alloca(ss_depth);
+  memset((char*)buf, 1, ss_depth);
+  for(long i=0;i<(long)p;i++){ buf[i % ss_depth]++; lwp_yield(); }
+  return 0;
+}
+
+// Created last: by the time it runs every worker is parked at depth
+static int ss_probe(void *p){
+  (void)p;
+  lwp_yield();
+  ss_rss = rss_kb();
+  return 0;
+}
+
+static void ss_one(long which){
+  long d = which / 2, shared = which % 2;
+  lwp_attr attr = { shared ? LWP_ATTR_SHARED_STACK : 0, 0 };
+  long each = env_long("BENCH_YIELDS", 2000000) / SS_THREADS;
+  ss_depth = ss_depths[d];
+  ss_rss0 = rss_kb();
+  for(long i=0;i<SS_THREADS;i++) lwp_create_attr(ss_worker, (void*)each, &attr);
+  lwp_create(ss_probe, NULL);
+  double t0 = now_ns();
+  drain();
+  double el = now_ns() - t0;
+  ss_ns[which] = el / (double)(SS_THREADS * each);
+
+  char extra[96];
+  snprintf(extra, sizeof extra, "\"depth\":%ld,\"bytes_per_thread\":%.0f",
+           ss_depth, (double)(ss_rss - ss_rss0) * 1024.0 / SS_THREADS);
+  report("shared_stack", shared ? "shared" : "private", SS_THREADS,
+         SS_THREADS * each, el, extra);
+}
+
+static void shared_stack(long unused){
+  (void)unused;
+  ss_ns = mmap(NULL, 2 * SS_NDEPTHS * sizeof *ss_ns, PROT_READ|PROT_WRITE,
+               MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(ss_ns == MAP_FAILED) return;
+  long cross = -1;
+  for(long d=0;d<SS_NDEPTHS;d++){
+    in_child(ss_one, 2 * d);
+    in_child(ss_one, 2 * d + 1);
+    if(cross < 0 && ss_ns[2 * d + 1] > 2 * ss_ns[2 * d]) cross = ss_depths[d];
+  }
+  char extra[64];
+  if(cross < 0) snprintf(extra, sizeof extra, "\"crossover_depth\":null");
+  else snprintf(extra, sizeof extra, "\"crossover_depth\":%ld", cross);
+  report("shared_stack", "crossover", SS_THREADS, 0, 0, extra);
+}
+
+/* ---------- huge-page arenas vs 4 KiB pages ----------
+ * The same yield loop over many 64 KiB-stack threads, with stacks and
+ * control blocks from ordinary mappings (mode 0) or huge pages (1).
+ */
+static long anon_huge_kb(void){
+  char line[128];
+  long kb = -1;
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if(!f) return -1;
+  while(fgets(line, sizeof line, f))
+    if(sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+  fclose(f);
+  return kb;
+}
+
+static int toucher(void *p){
+  volatile char buf[2048];
+  for(long i=0;i<(long)p;i++){ buf[i % sizeof buf] = (char)i; lwp_yield(); }
+  return buf[0];
+}
+
+// Created last: starts the clock once every stack has been faulted in
+static int hp_fd;
+static long hp_m0;
+static double hp_t0;
+static int hp_probe(void *p){
+  (void)p;
+  lwp_yield();
+  hp_m0 = hw_read(hp_fd);
+  hp_t0 = now_ns();
+  return 0;
+}
+
+static void hugepages(long which){
+  long threads = which / 2, on = which % 2;
+  if(!fits_in_memory(threads, 65536)){
+    report_skip("hugepages", on ? "huge" : "4k", threads, "not enough memory");
+    return;
+  }
+  int kind = on ? lwp_hugepages(1) : 0;
+  if(on && !kind){
+    report_skip("hugepages", "huge", threads, "no huge pages available");
+    return;
+  }
+  lwp_attr attr = { 0, 65536 };
+  long each = env_long("BENCH_YIELDS", 2000000) / threads;
+  if(each < 2) each = 2;
+  for(long i=0;i<threads;i++) lwp_create_attr(toucher, (void*)each, &attr);
+  lwp_create(hp_probe, NULL);
+
+  hp_fd = dtlb_miss_counter();
+  drain();
+  double el = now_ns() - hp_t0;
+  long m1 = hw_read(hp_fd);
+  long ops = threads * (each - 1);
+
+  char misses[64], extra[192];
+  per_op_field(misses, sizeof misses, "dtlb_misses",
+               hp_m0 < 0 || m1 < 0 ? -1 : m1 - hp_m0, ops);
+  snprintf(extra, sizeof extra, "\"pages\":\"%s\",%s,\"anon_huge_kb\":%ld",
+           kind == LWP_HUGE_TLB ? "hugetlb" : kind == LWP_HUGE_THP ? "thp" : "4k",
+           misses, anon_huge_kb());
+  report("hugepages", on ? "huge" : "4k", threads, ops, el, extra);
+}
+
+/* ---------- generator: coroutine vs producer/consumer LWPs ---------- */
+static volatile long gen_sum;
+
+static void *gen_count(void *in){
+  for(long i=0;i<(long)in;i++) lwp_coro_yield((void*)i);
+  return NULL;
+}
+
+static long pc_slot, pc_full, pc_n;
+static int pc_producer(void *p){
+  (void)p;
+  for(long i=0;i<pc_n;i++){
+    while(pc_full) lwp_yield();
+    pc_slot = i;
+    pc_full = 1;
+  }
+  return 0;
+}
+static int pc_consumer(void *p){
+  (void)p;
+  long sum = 0;
+  for(long i=0;i<pc_n;i++){
+    while(!pc_full) lwp_yield();
+    sum += pc_slot;
+    pc_full = 0;
+  }
+  gen_sum = sum;
+  return 0;
+}
+
+static void generator(long n){
+  lwp_coro co = lwp_coro_create(gen_count, 0);
+  long sum = 0;
+  double t0 = now_ns();
+  void *v = lwp_coro_resume(co, (void*)n);
+  while(!lwp_coro_done(co)){
+    sum += (long)v;
+    v = lwp_coro_resume(co, NULL);
+  }
+  report("generator", "coro", 1, n, now_ns() - t0, NULL);
+  lwp_coro_destroy(co);
+  gen_sum = sum;
+
+  pc_n = n;
+  pc_full = 0;
+  lwp_create(pc_producer, NULL);
+  lwp_create(pc_consumer, NULL);
+  t0 = now_ns();
+  drain();
+  report("generator", "lwp_yield", 2, n, now_ns() - t0, NULL);
+}
+
+/* ---------- LWP-local storage lookups ---------- */
+static void key_lookup(long n){
+  lwp_key_t k[LWP_KEYS_INLINE + 1];
+  for(int i=0;i<=LWP_KEYS_INLINE;i++){
+    lwp_key_create(&k[i], NULL);
+    lwp_setspecific(k[i], &k[i]);
+  }
+  for(int spill=0;spill<2;spill++){
+    lwp_key_t key = k[spill ? LWP_KEYS_INLINE : 0];
+    long sum = 0;
+    double t0 = now_ns();
+    for(long i=0;i<n;i++){
+      sum += (long)lwp_getspecific(key);
+      __asm__ volatile("" : "+r"(sum));
+    }
+    report("key_lookup", spill ? "spilled" : "inline", 1, n, now_ns() - t0, NULL);
+  }
+}
+
+/* ---------- parking lot vs spin-yield under contention ----------
+ * n LWPs take one lock in turn, each holding it across a yield.  With
+ * spin-yield every waiter is scheduled (and yields straight back) at
+ * each switch; parked waiters stay off the queue until handed the lock.
+ */
+static int  pk_word;
+static long pk_rounds;
+
+static int pk_parker(void *p){
+  (void)p;
+  for(long i=0;i<pk_rounds;i++){
+    int c = __sync_val_compare_and_swap(&pk_word, 0, 1);
+    if(c){
+      if(c != 2) c = __atomic_exchange_n(&pk_word, 2, __ATOMIC_ACQUIRE);
+      while(c){
+        lwp_park(&pk_word, 2);
+        c = __atomic_exchange_n(&pk_word, 2, __ATOMIC_ACQUIRE);
+      }
+    }
+    lwp_yield();
+    if(__atomic_fetch_sub(&pk_word, 1, __ATOMIC_RELEASE) != 1){
+      __atomic_store_n(&pk_word, 0, __ATOMIC_RELEASE);
+      lwp_unpark_one(&pk_word);
+    }
+  }
+  return 0;
+}
+
+static int pk_spinner(void *p){
+  (void)p;
+  for(long i=0;i<pk_rounds;i++){
+    while(!__sync_bool_compare_and_swap(&pk_word, 0, 1)) lwp_yield();
+    lwp_yield();
+    __atomic_store_n(&pk_word, 0, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+static void park_contention(long n){
+  pk_rounds = 200000 / n;
+  for(int spin=0;spin<2;spin++){
+    pk_word = 0;
+    for(long i=0;i<n;i++) lwp_create(spin ? pk_spinner : pk_parker, NULL);
+    double t0 = now_ns();
+    drain();
+    report("park_contention", spin ? "spin_yield" : "park", n, n * pk_rounds,
+           now_ns() - t0, NULL);
+  }
+}
+
+/* ---------- locality groups: shared working sets, RR vs gang ----------
+ * GL_GROUPS groups of GL_MEMBERS LWPs, each group sharing a buffer of
+ * BENCH_GROUP_KB; every run sweeps the buffer once and yields.  The
+ * threads are created interleaved, so RR never runs two members of a
+ * group in a row and the buffers (together larger than L2) keep
+ * evicting each other; the group scheduler runs each group's members
+ * back to back and only the first of them finds its buffer cold.
+ */
+#define GL_GROUPS  8
+#define GL_MEMBERS 4
+static char *gl_buf[GL_GROUPS];
+static long gl_kb, gl_rounds;
+
+static int gl_member(void *p){
+  const char *b = gl_buf[(long)p];
+  long sum = 0;
+  for(long r=0;r<gl_rounds;r++){
+    for(long i=0;i<gl_kb*1024;i+=64) sum += b[i];
+    __asm__ volatile("" : "+r"(sum));
+    lwp_yield();
+  }
+  return 0;
+}
+
+static void group_locality(long grouped){
+  gl_kb = env_long("BENCH_GROUP_KB", 1024);
+  gl_rounds = 200;
+  for(int g=0;g<GL_GROUPS;g++){
+    gl_buf[g] = (char*)malloc(gl_kb * 1024);
+    memset(gl_buf[g], g, gl_kb * 1024);
+  }
+  if(grouped) lwp_set_scheduler(lwp_group_scheduler());
+  for(int m=0;m<GL_MEMBERS;m++)
+    for(long g=0;g<GL_GROUPS;g++)
+      lwp_set_group(lwp_create(gl_member, (void*)g), (unsigned)g + 1);
+
+  int fd = hw_counter(PERF_COUNT_HW_CACHE_MISSES);
+  long m0 = hw_read(fd);
+  double t0 = now_ns();
+  drain();
+  double el = now_ns() - t0;
+  long m1 = hw_read(fd);
+  long runs = GL_GROUPS * GL_MEMBERS * gl_rounds;
+  char extra[96];
+  per_op_field(extra, sizeof extra, "llc_misses", m0 < 0 || m1 < 0 ? -1 : m1 - m0, runs);
+  report("group_locality", grouped ? "group" : "rr", GL_GROUPS * GL_MEMBERS, runs, el, extra);
+  if(fd >= 0) close(fd);
+}
+
+/* ---------- short tasks: lwp_submit vs an LWP each vs a plain call ---------- */
+static long st_sum;
+
+static int st_task(void *p){
+  st_sum += (long)p;
+  return 0;
+}
+
+static void short_tasks(long n){
+  int (*volatile call)(void *) = st_task;       // not inlined away
+  double t0 = now_ns();
+  for(long i=0;i<n;i++) call((void*)i);
+  report("short_tasks", "function_call", 1, n, now_ns() - t0, NULL);
+
+  t0 = now_ns();
+  for(long i=0;i<n;i++) lwp_submit(st_task, (void*)i);
+  drain();
+  report("short_tasks", "lwp_submit", 1, n, now_ns() - t0, NULL);
+
+  lwp_attr det = { LWP_ATTR_DETACHED, 0 };
+  t0 = now_ns();
+  for(long i=0;i<n;i++) lwp_create_attr(st_task, (void*)i, &det);
+  drain();
+  report("short_tasks", "lwp_create_detached", n, n, now_ns() - t0, NULL);
+}
+
+/* ---------- quota accounting on the switch path ----------
+ * The pingpong again, with the two yielders in a group whose quota
+ * (the whole period) never throttles: what charging costs per switch.
+ */
+static void quota_pingpong(long n){
+  lwp_group_quota(1, 100000, 100000);
+  lwp_set_group(lwp_create(yielder, (void*)n), 1);
+  lwp_set_group(lwp_create(yielder, (void*)n), 1);
+  double t0 = now_ns();
+  drain();
+  report("quota_pingpong", "lwp", 2, 2 * n, now_ns() - t0, NULL);
+}
+
+/* ---------- idle policy: wakeup latency vs CPU burnt while idle ----------
+ * A pthread posts a wakeup every IDLE_GAP_NS to an LWP sitting in
+ * lwp_suspend(); the LWP side has nothing else to do.  ns_per_op is
+ * the mean post-to-resume latency, cpu_pct the process CPU time over
+ * wall time (the poster's share is tiny).
+ */
+#define IDLE_GAP_NS 200000
+static volatile double idle_posted;
+static volatile long idle_seen;         // wakeups consumed (they don't queue up)
+static long idle_n;
+static double *idle_lat;
+
+static void *idle_poster(void *p){
+  tid_t tid = (tid_t)p;
+  struct timespec gap = { 0, IDLE_GAP_NS };
+  for(long i=0;i<idle_n;i++){
+    do nanosleep(&gap, NULL); while(idle_seen < i);
+    idle_posted = now_ns();
+    lwp_post_wakeup(tid);
+  }
+  return NULL;
+}
+
+static int idle_waiter(void *p){
+  (void)p;
+  pthread_t pt;
+  pthread_create(&pt, NULL, idle_poster, (void*)lwp_gettid());
+  for(long i=0;i<idle_n;i++){
+    lwp_suspend();
+    idle_lat[i] = now_ns() - idle_posted;
+    idle_seen = i + 1;
+  }
+  pthread_join(pt, NULL);
+  return 0;
+}
+
+static int cmp_double(const void *a, const void *b){
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static void idle_policy(long which){
+  static const struct { int policy; unsigned long spins; const char *name; } p[] = {
+    { LWP_IDLE_SPIN,      100,    "spin" },
+    { LWP_IDLE_SPIN_PARK, 1000,   "spin1k_park" },
+    { LWP_IDLE_SPIN_PARK, 100000, "spin100k_park" },
+    { LWP_IDLE_PARK,      0,      "park" },
+  };
+  idle_n = env_long("BENCH_IDLE_WAKEUPS", 2000);
+  idle_seen = 0;
+  idle_lat = (double*)malloc(idle_n * sizeof *idle_lat);
+  lwp_set_idle(p[which].policy, p[which].spins);
+
+  lwp_create(idle_waiter, NULL);
+  double c0 = cpu_ns(), t0 = now_ns();
+  drain();
+  double wall = now_ns() - t0, cpu = cpu_ns() - c0;
+
+  double sum = 0;
+  for(long i=0;i<idle_n;i++) sum += idle_lat[i];
+  qsort(idle_lat, idle_n, sizeof *idle_lat, cmp_double);
+  char extra[128];
+  snprintf(extra, sizeof extra, "\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"cpu_pct\":%.1f",
+           idle_lat[idle_n / 2], idle_lat[idle_n * 99 / 100], 100.0 * cpu / wall);
+  report("idle_policy", p[which].name, 1, idle_n, sum, extra);
+  free(idle_lat);
+  lwp_set_idle(LWP_IDLE_SPIN_PARK, 1000);
+}
+
+/* ---------- independent runtimes, one per pthread ----------
+ * Each pthread binds a runtime of its own and runs a pair of yielders;
+ * with nothing shared the aggregate rate should scale with the cores
+ * (ns_per_op is wall time over all yields, so it should drop as 1/n).
+ */
+static long rt_yields;
+
+static void *rt_host(void *p){
+  (void)p;
+  lwp_runtime *r = lwp_runtime_create();
+  if(!r) return NULL;
+  lwp_runtime_bind(r);
+  lwp_create(yielder, (void*)rt_yields);
+  lwp_create(yielder, (void*)rt_yields);
+  drain();
+  lwp_runtime_bind(NULL);
+  lwp_runtime_destroy(r);
+  return NULL;
+}
+
+static void runtimes(long n){
+  rt_yields = env_long("BENCH_PINGPONG", 1000000);
+  pthread_t *pt = (pthread_t*)malloc(n * sizeof *pt);
+  double t0 = now_ns();
+  for(long i=0;i<n;i++) pthread_create(&pt[i], NULL, rt_host, NULL);
+  for(long i=0;i<n;i++) pthread_join(pt[i], NULL);
+  char extra[64];
+  snprintf(extra, sizeof extra, "\"cpus\":%ld", sysconf(_SC_NPROCESSORS_ONLN));
+  report("runtimes", "pthread_per_runtime", n, n * 2 * rt_yields, now_ns() - t0, extra);
+  free(pt);
+}
+
+int main(int argc, char *argv[]){
+  static const long counts[] = { 2, 100, 10000, 100000, 1000000 };
+  if(argc > 1) bench_filter = argv[1];
+
+  RUN("create_exit_wait", create_exit_wait, env_long("BENCH_CREATES", 100000));
+  RUN("yield_pingpong",   yield_pingpong,   env_long("BENCH_PINGPONG", 1000000));
+  RUN("trace_overhead",   trace_overhead,   4096);
+  RUN("trace_overhead",   trace_overhead,   65536);
+  for(unsigned i=0;i<sizeof counts/sizeof counts[0];i++)
+    RUN("yield_throughput", yield_throughput, counts[i]);
+  RUN("startup",             startup_loop,   100000);
+  RUN("startup",             startup_many,   100000);
+  RUN("reap",                reap,           2 * 100000);
+  RUN("reap",                reap,           2 * 100000 + 1);
+  RUN("scheduler_migration", migration,      100);
+  RUN("scheduler_migration", migration,      1000);
+  RUN("rss_per_thread",      rss_per_thread, 1000);
+  RUN("rss_per_thread",      rss_per_thread, 10000);
+  RUN("shared_stack",        shared_stack,   0);
+  for(long n = 1000; n <= 10000; n *= 10){
+    RUN("hugepages",           hugepages,      2 * n);
+    RUN("hugepages",           hugepages,      2 * n + 1);
+  }
+  for(long i=0;i<4;i++)
+    RUN("idle_policy",       idle_policy,    i);
+  for(long n = 1; n <= 8; n *= 2)
+    RUN("runtimes",          runtimes,       n);
+  RUN("key_lookup",          key_lookup,     10000000);
+  RUN("generator",           generator,      env_long("BENCH_PINGPONG", 1000000));
+  for(long n = 2; n <= 512; n *= 4)
+    RUN("park_contention",   park_contention, n);
+  RUN("group_locality",      group_locality, 0);
+  RUN("group_locality",      group_locality, 1);
+  RUN("short_tasks",         short_tasks,    1000000);
+  RUN("quota_pingpong",      quota_pingpong, env_long("BENCH_PINGPONG", 1000000));
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "lwp.h"
 #include "fp.h"
+#include "tsc.h"
+#include "slab.h"
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -7,14 +9,65 @@
 #include <stdint.h>
 #include <stdio.h>
 
-// Global state
-typedef struct glnode { thread t; struct glnode *next; } glnode;
-static scheduler cur_sched = NULL;   // current scheduler
-static thread    current   = NULL;
-static tid_t     next_tid  = 1;
-static thread scheduler_main = NULL;
-static thread term_head = NULL, term_tail = NULL;
-static glnode *ghead = NULL;
+#define SEEN_MAX     1024           // notify rotation: tids tracked
+#define STACK_KEEP   64             // freed default stacks kept for reuse
+#define STACK_CACHES 8              // huge-page stack sizes
+#define RT_SHIFT     48             // tid bits from here up: runtime id
+
+/* Runtime state.  Everything that used to be a file-static here is a
+ * field of the runtime the calling OS thread has bound (rt), so
+ * several runtimes can run side by side on different pthreads without
+ * sharing a line of memory.  The pointer itself is thread-local, with
+ * the initial-exec model so reaching it is a single %fs-relative load.
+ */
+struct lwp_runtime {
+    scheduler  cur_sched;           // current scheduler
+    thread     current;
+    tid_t      next_tid;
+    thread     scheduler_main;
+    thread     term_head, term_tail;
+    thread     ghead;               // all threads, via lib_one/lib_two
+    long       live_count;          // LWPs (not main) not yet exited
+    thread     reap_pending;        // see reap_deferred()
+    thread     exit_next;           // thread_handoff() target
+    lwp_hist   *cur_hist;           // histogram of cur_sched
+    rr_queue   rr;                  // sched_rr.c's queue
+    slab_cache tcb_slab, rfile_slab;
+    unsigned long *stack_keep;      // see release_stack()
+    int        stack_kept;
+    thread     sstack_next;         // shared-stack mode, see sstack_switch()
+    thread     stamped;             // sched_next()'s pick, read at stamp
+    unsigned long stamp;
+    thread     sstack_helper;
+    int        huge_kind;           // HUGE_* while on, else 0
+    slab_cache stack_caches[STACK_CACHES];
+    int        notify_need_live;    // notification rotation state
+    int        notify_seen_cnt;
+    int        notify_seen_len;
+    tid_t      notify_seen[SEEN_MAX];
+    sched_hist hists[HIST_SCHEDS];  // lwp_hist.c's, per scheduler
+    park_bucket park[PARK_BUCKETS]; // lwp_park.c's wait queues
+    group_table groups;             // lwp_group.c's
+    task_queue tasks;               // lwp_submit.c's
+    unsigned   id;                  // index in runtimes[], tid bits
+    lwp_inbox  inbox;               // posts from other OS threads
+};
+
+static lwp_runtime default_rt = {
+    .next_tid   = 1,
+    .tcb_slab   = SLAB_CACHE(context, 64),
+    .rfile_slab = SLAB_CACHE(rfile, 64),
+    .inbox      = { .head = &default_rt.inbox.stub,
+                    .tail = &default_rt.inbox.stub, .fd = -1 },
+};
+
+static __thread lwp_runtime *rt __attribute__((tls_model("initial-exec")))
+    = &default_rt;
+
+// By id, for posts from other threads; slots are never reused
+static lwp_runtime *runtimes[LWP_RUNTIMES_MAX] = { &default_rt };
+static unsigned nruntimes = 1;
+
 static struct fxsave FPU_INIT_CONST;
 static int FPU_INIT_DONE = 0;
 
@@ -26,75 +79,77 @@ static void init_fpu_const(void){
     FPU_INIT_DONE = 1;
 }
 
-// Notification rotation state
-static int notify_need_live = 0;
-static int notify_seen_cnt  = 0;
-
-// Seen TID tracking
-#define SEEN_MAX 1024
-static tid_t notify_seen[SEEN_MAX];
-static int   notify_seen_len = 0;
-
 // Reset notification rotation tracking
 static void notify_reset_counts(int live){
-    notify_need_live = live;
-    notify_seen_cnt  = 0;
-    notify_seen_len  = 0;
+    rt->notify_need_live = live;
+    rt->notify_seen_cnt  = 0;
+    rt->notify_seen_len  = 0;
 }
 
 // Mark a TID as seen for notification rotation
 static int notify_mark_seen(tid_t tid){
     // Check if already seen
-    for(int i=0;i<notify_seen_len;i++){
-        if(notify_seen[i] == tid) return 0; // already counted
+    for(int i=0;i<rt->notify_seen_len;i++){
+        if(rt->notify_seen[i] == tid) return 0; // already counted
     }
-    if(notify_seen_len < SEEN_MAX){
-        notify_seen[notify_seen_len++] = tid;
-        notify_seen_cnt++;
+    if(rt->notify_seen_len < SEEN_MAX){
+        rt->notify_seen[rt->notify_seen_len++] = tid;
+        rt->notify_seen_cnt++;
         return 1;
     }
     return 0; // set full; behave as already seen
 }
 
 
+// Control blocks and their register files come from separate slabs
+static thread tcb_alloc(void){
+    thread t = (thread)slab_alloc(&rt->tcb_slab);
+    if(!t) return NULL;
+    t->state = (rfile*)slab_alloc(&rt->rfile_slab);
+    if(!t->state){
+        slab_free(&rt->tcb_slab, t);
+        return NULL;
+    }
+    return t;
+}
+
+static void tcb_free(thread t){
+    free(t->hist);
+    slab_free(&rt->rfile_slab, t->state);
+    slab_free(&rt->tcb_slab, t);
+}
+
 // enqueue onto terminated FIFO (oldest-first)
 static void term_enqueue(thread t){
     t->exited = NULL;
-    if(!term_head) term_head = term_tail = t;
-    else { term_tail->exited = t; term_tail = t; }
+    if(!rt->term_head) rt->term_head = rt->term_tail = t;
+    else { rt->term_tail->exited = t; rt->term_tail = t; }
 }
 
 // dequeue from terminated FIFO (oldest-first)
 static thread term_dequeue(void){
-    if(!term_head) return NULL;
-    thread t = term_head;
-    term_head = term_head->exited;
-    if(!term_head) term_tail = NULL;
+    if(!rt->term_head) return NULL;
+    thread t = rt->term_head;
+    rt->term_head = rt->term_head->exited;
+    if(!rt->term_head) rt->term_tail = NULL;
     t->exited = NULL;
     return t;
 }
 
-// All-threads singly-linked list management
+// All-threads list, linked through lib_one (next) and lib_two (prev)
 static void add_thread_global(thread t){
-    glnode *n = (glnode*)malloc(sizeof(*n));
-    if(!n) return; 
-    n->t = t; 
-    n->next = ghead; 
-    ghead = n;
+    t->lib_two = NULL;
+    t->lib_one = rt->ghead;
+    if(rt->ghead) rt->ghead->lib_two = t;
+    rt->ghead = t;
 }
 
 // Remove thread from global list
 static void remove_thread_global(thread t){
-    glnode **pp = &ghead;
-    while (*pp) {
-        if ((*pp)->t == t) {
-            glnode *dead = *pp;
-            *pp = dead->next;
-            free(dead);
-            return;
-        }
-        pp = &(*pp)->next;
-    }
+    if(t->lib_two) t->lib_two->lib_one = t->lib_one;
+    else           rt->ghead = t->lib_one;
+    if(t->lib_one) t->lib_one->lib_two = t->lib_two;
+    t->lib_one = t->lib_two = NULL;
 }
 
 // Minimal internal RR scheduler forward (implemented in sched_rr.c)
@@ -102,264 +157,949 @@ extern scheduler rr_scheduler(void);
 
 // Ensure the default scheduler is initialized once
 static void ensure_scheduler(void){
-    if(!cur_sched){
-        cur_sched = rr_scheduler();        // factory from sched_rr.c
-        if(cur_sched && cur_sched->init)
-            cur_sched->init();
+    if(!rt->cur_sched){
+        rt->cur_sched = rr_scheduler();        // factory from sched_rr.c
+        if(rt->cur_sched && rt->cur_sched->init)
+            rt->cur_sched->init();
+    }
+}
+
+// Run-queue latency recording: stamp on admit, bucket on dispatch
+static int hist_threads = 0;         // also record per thread?
+
+// now: the admission time (a batch shares one)
+static void sched_admit_at(thread t, unsigned long now){
+    t->admit_tsc = now;
+    if (hist_threads && !t->hist)
+        t->hist = (lwp_hist*)calloc(1, sizeof(*t->hist));
+    rt->cur_sched->admit(t);
+}
+
+static void sched_admit(thread t){
+    sched_admit_at(t, tsc_now());
+}
+
+static thread sched_next(void){
+    if (__builtin_expect(INBOX_PENDING(&rt->inbox), 0)) inbox_drain(&rt->inbox);
+    thread t = rt->cur_sched->next();
+    if (__builtin_expect(rt->groups.quotas != 0, 0)) t = quota_pick(t);
+    rt->stamped = NULL;
+    if (t && t->admit_tsc){
+        unsigned long now = tsc_now();
+        unsigned long wait = now - t->admit_tsc;
+        rt->stamped = t;                // the switch to t is traced at now
+        rt->stamp   = now;
+        if (!rt->cur_hist) rt->cur_hist = hist_for(rt->cur_sched);
+        hist_record(rt->cur_hist, wait);
+        if (t->hist) hist_record(t->hist, wait);
+        t->admit_tsc = 0;
+    }
+    return t;
+}
+
+// Tracing costs one well-predicted branch when it is off
+#define TRACE(ty, a, b) \
+    do { if (__builtin_expect(lwp_trace_on, 0)) trace_emit(ty, a, b); } while (0)
+
+/* A switch to what sched_next() just picked reuses the timestamp it took
+ * for the histogram: rdtsc can cost as much as the rest of the event.
+ */
+static void trace_switch(thread old, thread next){
+    if (rt->stamped == next) trace_emit_at(rt->stamp, LWP_EV_SWITCH, old->tid, next->tid);
+    else                     trace_emit(LWP_EV_SWITCH, old->tid, next->tid);
+}
+
+// Same idea for the shared-memory stats segment
+#define STATS(call) \
+    do { if (__builtin_expect(lwp_stats != NULL, 0)) call; } while (0)
+
+static int  materialize(thread t);
+static int  get_stack(thread t, size_t stksz);
+static void sstack_switch(thread old, thread next);
+static void reap(thread t);
+
+/* A detached thread can't free its own stack while it is still running
+ * on it, so lwp_exit() leaves it here and whoever runs next frees it
+ * straight after the switch.  There is never more than one.
+ */
+static void reap_deferred(void){
+    thread t = rt->reap_pending;
+    rt->reap_pending = NULL;
+    STATS(stats_detach(t));
+    reap(t);
+}
+
+/* A pending thread whose stack can't be mapped exits with status 0xFF
+ * without ever running; lwp_wait() reaps it like any other.
+ */
+static void abandon(thread t){
+    t->status = MKTERMSTAT(LWP_TERM, 0xFF);
+    TRACE(LWP_EV_EXIT, t->tid, t->status);
+    STATS(stats_exit(t));
+    rt->live_count--;
+    notify_reset_counts((int)rt->live_count);
+    if(t->flags & LWPF_DETACHED){
+        STATS(stats_detach(t));
+        reap(t);
+    } else {
+        term_enqueue(t);
     }
 }
 
+// Every context switch goes through here
+static void ctx_switch(thread old, thread next){
+    if (__builtin_expect(!next->state, 0) && materialize(next)){
+        abandon(next);
+        if (old == rt->scheduler_main) return;
+        next = rt->scheduler_main;
+    }
+    if (__builtin_expect(lwp_trace_on, 0)) trace_switch(old, next);
+    rt->stamped = NULL;
+    STATS(stats_switch(old, next));
+    if (__builtin_expect(lwp_pmc_on, 0)) pmc_switch(old);
+    rt->current = next;
+    if (__builtin_expect(next->flags & LWPF_SHARED, 0))
+        sstack_switch(old, next);
+    else
+        swap_rfiles(old->state, next->state);
+    if (__builtin_expect(rt->reap_pending != NULL, 0)) reap_deferred();
+}
+
 // Find thread by TID
 thread tid2thread(tid_t tid){
-    for (glnode *p = ghead; p; p = p->next){
-        if (p->t->tid == tid) return p->t;
+    for (thread t = rt->ghead; t; t = t->lib_one){
+        if (t->tid == tid) return t;
     }
     return NULL; // MUST return NULL for a bad tid
 }
 
-// Trampoline function for new LWPs
-static void lwp_trampoline(lwpfun f, void *arg){
+// Turn the calling (original) thread into scheduler_main
+static thread new_main(void){
+    rt->scheduler_main = tcb_alloc();
+    if(!rt->scheduler_main) return NULL;
+    rt->scheduler_main->tid    = rt->next_tid++;
+    rt->scheduler_main->status = MKTERMSTAT(LWP_LIVE, 0);
+    add_thread_global(rt->scheduler_main);
+    STATS(stats_attach(rt->scheduler_main, 0));
+    return rt->scheduler_main;
+}
+
+// Trampoline function for new LWPs (called from lwp_boot in magic64.S)
+__attribute__((visibility("hidden")))
+void lwp_trampoline(lwpfun f, void *arg){
+    if (rt->reap_pending) reap_deferred();          // first run: see ctx_switch
     int rc = f ? f(arg) : 0;
     lwp_exit(rc);
 }
 
-// Create: allocate and initialize a new thread
-tid_t lwp_create(lwpfun f, void *arg){
-    thread t = (thread)calloc(1, sizeof(*t));
-    if(!t) return NO_THREAD;
+/* Shared boot frame for magic64.S (leave; ret).  Every new thread's
+ * saved rbp/rsp point here: 'leave' pops the dummy rbp and 'ret' pops
+ * lwp_boot, which moves onto the real stack.  Because nothing is
+ * written to the thread's stack until it first runs, creating a thread
+ * doesn't fault in a single stack page.
+ */
+extern void lwp_boot(void);
+static const unsigned long boot_frame[2] __attribute__((aligned(16))) = {
+    0UL, (unsigned long)lwp_boot
+};
 
-    // Bookkeeping
-    t->tid    = next_tid++;
-    t->status = MKTERMSTAT(LWP_LIVE, 0);
-
-    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
-    size_t stksz  = 1UL<<20;                      // 1 MiB default
-    stksz = (stksz + pagesz - 1) & ~(pagesz - 1); // page aligned
+// Default stack: 1 MiB, page aligned
+static size_t default_stacksize(void){
+    static size_t stksz = 0;
+    if(!stksz){
+        size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+        stksz = ((1UL<<20) + pagesz - 1) & ~(pagesz - 1);  // 1 MiB default
+    }
+    return stksz;
+}
 
+static int stack_map_flags(void){
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
 #ifdef MAP_STACK
     flags |= MAP_STACK;
 #endif
-    void *stk = mmap(NULL, stksz, PROT_READ|PROT_WRITE, flags, -1, 0);
-    if(stk == MAP_FAILED){
-        free(t);
-        return NO_THREAD;
-    }
+    return flags;
+}
 
-    t->stack     = (unsigned long*)stk;
-    t->stacksize = stksz;
+// Registers, FPU state and boot frame so the first switch enters f(arg)
+static void boot_init(thread t, lwpfun f, void *arg){
+    t->entry = f;
+    t->arg   = arg;
 
     // Pass (f,arg) to trampoline per SysV AMD64 ABI
-    t->state.rdi = (unsigned long)f;
-    t->state.rsi = (unsigned long)arg;
+    t->state->rdi = (unsigned long)f;
+    t->state->rsi = (unsigned long)arg;
 
     // Zero other GPRs
-    t->state.rax = t->state.rbx = t->state.rcx = t->state.rdx = 0;
-    t->state.r8  = t->state.r9  = t->state.r10 = t->state.r11 = 0;
-    t->state.r12 = t->state.r13 = t->state.r14 = t->state.r15 = 0;
-    t->state.rbp = 0;
+    t->state->rax = t->state->rbx = t->state->rcx = t->state->rdx = 0;
+    t->state->r8  = t->state->r9  = t->state->r10 = t->state->r11 = 0;
+    t->state->r12 = t->state->r13 = t->state->r14 = t->state->r15 = 0;
+    t->state->rbp = 0;
 
     // FPU init (safe memcpy to avoid alignment faults)
     init_fpu_const();
-    memcpy(&t->state.fxsave, &FPU_INIT_CONST, sizeof t->state.fxsave);
+    memcpy(&t->state->fxsave, &FPU_INIT_CONST, sizeof t->state->fxsave);
+
+    // lwp_boot starts f(arg) on a 16B-aligned top of stack (rdx), so
+    // the 'call' into lwp_trampoline leaves rsp %16 == 8 as the ABI wants
+    uintptr_t top = (uintptr_t)t->stack + t->stacksize;
+    t->state->rdx = top & ~(uintptr_t)0xFUL;
+
+    t->state->rbp = (unsigned long)boot_frame;   // 'leave' uses this
+    t->state->rsp = (unsigned long)boot_frame;   // 'ret' pops lwp_boot
+}
+
+// Make a booted thread known to the library (not yet admitted)
+static void register_thread(thread t){
+    t->group = rt->current ? rt->current->group : 0;
+    add_thread_global(t);
+    rt->live_count++;
+    TRACE(LWP_EV_CREATE, t->tid, lwp_gettid());
+    STATS(stats_attach(t, 1));
+}
+
+/* Shared-stack mode.  Every group has a shared stack of its own, made
+ * when the first of its LWPF_SHARED threads first runs; a thread stays
+ * on the one it started on even if it changes group later.  A struct
+ * sstack at the very top of the mapping, above every thread's frames,
+ * says whose frames are on it right now.  Switching to a shared thread
+ * that isn't its stack's owner goes through a helper context on a stack
+ * of its own, since nobody can copy over the stack they are running on:
+ * the helper copies the owner's live frames (saved rsp up to the top)
+ * out to its heap buffer and the new thread's back in.  A shared thread
+ * switching to a private one, or to one on another group's stack,
+ * leaves its frames in place, so the copy is only paid when two shared
+ * threads of one group take turns.
+ */
+#define SSTACK_HELPER_SIZE (64 * 1024)
+#define SSTACK_TOP         64       // room for the struct sstack, 16B-aligned
+
+struct sstack {
+    thread owner;                   // whose frames are on the stack
+    char   *map;                    // the mapping, guard page first
+    size_t len;
+};
+
+// The stack t runs on (t is shared, and has run)
+static struct sstack *sstack_of(thread t){
+    return (struct sstack*)((char*)t->stack + t->stacksize);
+}
+
+// Copy t's live frames off the shared stack into a right-sized buffer
+static void sstack_save(thread t){
+    char  *top = (char*)t->stack + t->stacksize;
+    size_t len = (size_t)(top - (char*)t->state->rsp);
+    if(len > t->savecap || len < t->savecap / 4){
+        size_t cap = (len + 255) & ~(size_t)255;
+        void *p = realloc(t->save, cap);
+        if(!p){
+            fprintf(stderr, "lwp: no memory to save shared stack of %lu\n", t->tid);
+            abort();
+        }
+        t->save = p;
+        t->savecap = cap;
+    }
+    memcpy(t->save, top - len, len);
+    t->savelen = len;
+}
+
+// The helper: evict the owner, install sstack_next, run it; forever
+static int sstack_loop(void *unused){
+    (void)unused;
+    for(;;){
+        thread next = rt->sstack_next;
+        struct sstack *s = sstack_of(next);
+        if(s->owner && s->owner != next && !LWPTERMINATED(s->owner->status))
+            sstack_save(s->owner);
+        if(next->savelen)
+            memcpy((char*)s - next->savelen, next->save, next->savelen);
+        next->savelen = 0;
+        s->owner = next;
+        swap_rfiles(rt->sstack_helper->state, next->state);
+    }
+    return 0;
+}
+
+// Boot the runtime's helper, once
+static int sstack_helper_init(void){
+    if(rt->sstack_helper) return 0;
+    thread h = tcb_alloc();
+    void *hs = h ? mmap(NULL, SSTACK_HELPER_SIZE, PROT_READ|PROT_WRITE,
+                        stack_map_flags(), -1, 0) : MAP_FAILED;
+    if(hs == MAP_FAILED){
+        if(h) tcb_free(h);
+        return -1;
+    }
+    h->stack     = (unsigned long*)hs;
+    h->stacksize = SSTACK_HELPER_SIZE;
+    boot_init(h, sstack_loop, NULL);
+    rt->sstack_helper = h;
+    return 0;
+}
+
+// g's shared stack (guard page below), mapped the first time it's needed
+static struct sstack *sstack_get(lwp_group *g){
+    if(g->sstack) return g->sstack;
+    if(sstack_helper_init()) return NULL;
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len    = default_stacksize() + pagesz;
+    char *m = (char*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+                          stack_map_flags(), -1, 0);
+    if(m == MAP_FAILED) return NULL;
+    mprotect(m, pagesz, PROT_NONE);
+
+    struct sstack *s = (struct sstack*)(m + len - SSTACK_TOP);
+    s->owner = NULL;
+    s->map   = m;
+    s->len   = len;
+    g->sstack = s;
+    return s;
+}
+
+static void sstack_unmap(struct sstack *s){
+    if(s) munmap(s->map, s->len);
+}
+
+static void sstack_switch(thread old, thread next){
+    if(sstack_of(next)->owner == next){     // its frames are still in place
+        swap_rfiles(old->state, next->state);
+        return;
+    }
+    rt->sstack_next = next;
+    swap_rfiles(old->state, rt->sstack_helper->state);
+}
+
+/* Huge-page mode: stacks come from one slab cache per stack size
+ * whose slabs are huge pages, so a freed stack is reused as is.
+ */
+static slab_cache *stack_cache(size_t size){
+    for(int i = 0; i < STACK_CACHES; i++){
+        slab_cache *c = &rt->stack_caches[i];
+        if(c->size == size) return c;
+        if(!c->size){
+            c->size  = size;
+            c->align = (size_t)sysconf(_SC_PAGESIZE);
+            c->flags = SLAB_HUGE | SLAB_NOZERO;
+            return c;
+        }
+    }
+    return NULL;                      // too many sizes: plain mmap
+}
+
+// A huge-page stack for t, or -1 to fall back to a mapping of its own
+static int huge_stack(thread t, size_t size){
+    slab_cache *c = stack_cache(size);
+    void *stk = c ? slab_alloc(c) : NULL;
+    if(!stk) return -1;
+    t->stack     = (unsigned long*)stk;
+    t->stacksize = size;
+    t->guardsize = 0;
+    t->flags    |= LWPF_HUGE;
+    return 0;
+}
+
+int lwp_hugepages(int on){
+    rt->huge_kind = on ? huge_probe() : HUGE_NONE;
+    if(rt->huge_kind){
+        rt->tcb_slab.flags   |= SLAB_HUGE;
+        rt->rfile_slab.flags |= SLAB_HUGE;
+    } else {
+        rt->tcb_slab.flags   &= ~SLAB_HUGE;
+        rt->rfile_slab.flags &= ~SLAB_HUGE;
+    }
+    return rt->huge_kind;
+}
+
+// Would t's (private, mapped) stack go into the stack_keep pool?
+static int stack_keepable(thread t){
+    return t->stack && rt->stack_kept < STACK_KEEP
+        && t->stacksize == default_stacksize()
+        && t->guardsize == (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Bytes mapped below t's stack: its guard page, or the page meant for one
+static size_t below_stack(thread t){
+    return (t->flags & LWPF_NOGUARD) ? (size_t)sysconf(_SC_PAGESIZE)
+                                     : t->guardsize;
+}
+
+/* Release a thread's stack (and the guard page below it, if any).
+ * Recently freed default-size stacks, guard page and all, are kept in
+ * the stack_keep pool for the next thread instead of an munmap/mmap/
+ * mprotect round trip, linked through their lowest word.
+ */
+static void release_stack(thread t){
+    if(t->flags & LWPF_HUGE){
+        slab_free(stack_cache(t->stacksize), t->stack);
+        return;
+    }
+    if(t->flags & LWPF_SHARED){
+        if(t->stack && sstack_of(t)->owner == t) sstack_of(t)->owner = NULL;
+        free(t->save);
+        t->save = NULL;
+        return;
+    }
+    if(stack_keepable(t)){
+        *(unsigned long**)t->stack = rt->stack_keep;
+        rt->stack_keep = t->stack;
+        rt->stack_kept++;
+        return;
+    }
+    if(t->stack && t->stacksize)
+        munmap((char*)t->stack - below_stack(t), t->stacksize + below_stack(t));
+}
+
+/* The guard below a lwp_create_many() slot, put in at first dispatch.
+ * MADV_GUARD_INSTALL (Linux 6.13) puts it in the page tables alone;
+ * mprotect() splits the reservation's VMA instead, and once
+ * vm.max_map_count pushes back the rest go unguarded.
+ */
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+static void slot_guard(thread t){
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    char *g = (char*)t->stack - pagesz;
+    if(madvise(g, pagesz, MADV_GUARD_INSTALL) && mprotect(g, pagesz, PROT_NONE))
+        return;
+    t->guardsize = pagesz;
+    t->flags &= ~LWPF_NOGUARD;
+}
+
+/* Give a pending thread its register file and stack, booted to enter
+ * entry(arg).  Called on the thread's first dispatch.  A non-zero
+ * stacksize here is the one asked for at creation; a stack already
+ * there is a lwp_create_many() slot.
+ */
+static int materialize(thread t){
+    t->state = (rfile*)slab_alloc(&rt->rfile_slab);
+    if(!t->state) return -1;
+
+    if(t->flags & LWPF_SHARED){
+        stack_guard_init();
+        size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+        lwp_group *g = group_get(t->group, 1);
+        struct sstack *s = g ? sstack_get(g) : NULL;
+        if(!s) goto fail;
+        t->stack     = (unsigned long*)(s->map + pagesz);
+        t->stacksize = (size_t)((char*)s - (s->map + pagesz));
+        t->guardsize = pagesz;
+    } else if(t->stack){
+        stack_guard_init();
+        slot_guard(t);
+        if(__builtin_expect(lwp_stack_paint, 0)) stack_paint(t);
+    } else if(get_stack(t, t->stacksize ? t->stacksize : default_stacksize())){
+        goto fail;
+    }
+    boot_init(t, t->entry, t->arg);
+    return 0;
+
+fail:
+    slab_free(&rt->rfile_slab, t->state);
+    t->state = NULL;
+    return -1;
+}
+
+/* A private stack of stksz bytes for t: from a huge-page cache in huge
+ * mode, else the stack_keep pool, else a fresh mapping with a guard
+ * page below it.  Painted if the watermark is on.
+ */
+static int get_stack(thread t, size_t stksz){
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    stack_guard_init();
+    if(rt->huge_kind && !huge_stack(t, stksz)) goto got;
+    if(rt->stack_keep && stksz == default_stacksize()){
+        t->stack     = rt->stack_keep;
+        t->stacksize = stksz;
+        t->guardsize = pagesz;
+        rt->stack_keep   = *(unsigned long**)rt->stack_keep;
+        rt->stack_kept--;
+        goto got;
+    }
+
+    char *stk = (char*)mmap(NULL, stksz + pagesz, PROT_READ|PROT_WRITE,
+                            stack_map_flags(), -1, 0);
+    if(stk == MAP_FAILED) return -1;
+    if(mprotect(stk, pagesz, PROT_NONE)){
+        munmap(stk, stksz + pagesz);
+        return -1;
+    }
+    t->stack     = (unsigned long*)(stk + pagesz);
+    t->stacksize = stksz;
+    t->guardsize = pagesz;
+got:
+    if(__builtin_expect(lwp_stack_paint, 0)) stack_paint(t);
+    return 0;
+}
 
-    // Build boot frame for magic64.S (leave; ret)
-    uintptr_t top    = (uintptr_t)t->stack + t->stacksize;
-    /* Pick a 16B-aligned base well inside the mapping, then add +8 so:
-    - after 'leave':  rsp = frame+8  => %16 == 0
-    - after 'ret'  :  rsp = frame+16 => %16 == 8  (ABI on function entry) */
-    uintptr_t frame  = ((top - 24) & ~(uintptr_t)0xFUL) + 8;
+/* A bare context for f(arg): control block, registers and stack from
+ * the same places as a thread's, but not an LWP -- no tid, never
+ * scheduled.  Coroutines run on these.
+ */
+thread ctx_new(lwpfun f, void *arg, size_t stacksize){
+    thread t = tcb_alloc();
+    if(!t) return NULL;
+    if(get_stack(t, stacksize ? stacksize : default_stacksize())){
+        tcb_free(t);
+        return NULL;
+    }
+    boot_init(t, f, arg);
+    return t;
+}
 
-    *(unsigned long *)(frame + 0) = 0UL;
-    *(unsigned long *)(frame + 8) = (unsigned long)(uintptr_t)lwp_trampoline;
+void ctx_free(thread t){
+    release_stack(t);
+    tcb_free(t);
+}
 
-    t->state.rbp = frame;   // 'leave' uses this
-    t->state.rsp = frame;   // 'ret' pops trampoline
+/* Create: allocate and initialize a new thread.  Only the control block
+ * is allocated here; the stack and register file wait for the thread's
+ * first dispatch (see materialize()), so a queued thread that hasn't
+ * started yet costs one slab object.
+ */
+tid_t lwp_create(lwpfun f, void *arg){
+    return lwp_create_attr(f, arg, NULL);
+}
 
+// Create with attributes (NULL: same as lwp_create)
+tid_t lwp_create_attr(lwpfun f, void *arg, const lwp_attr *attr){
+    thread t = (thread)slab_alloc(&rt->tcb_slab);
+    if(!t) return NO_THREAD;
+
+    // Bookkeeping
+    t->tid    = rt->next_tid++;
+    t->status = MKTERMSTAT(LWP_LIVE, 0);
+    t->entry  = f;
+    t->arg    = arg;
+    if(attr){
+        size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+        if(attr->flags & LWP_ATTR_SHARED_STACK) t->flags |= LWPF_SHARED;
+        else if(attr->stacksize)
+            t->stacksize = (attr->stacksize + pagesz - 1) & ~(pagesz - 1);
+        if(attr->flags & LWP_ATTR_DETACHED) t->flags |= LWPF_DETACHED;
+    }
 
     // Register thread and admit to scheduler
-    add_thread_global(t);
+    register_thread(t);
+    ensure_scheduler();
+    if(rt->cur_sched && rt->cur_sched->admit) sched_admit(t);
+
+    return t->tid;
+}
+
+/* Create n threads running f(args[i]) in one go.  The control blocks
+ * come from one slab run and the stacks from one reservation, a page
+ * apart for guards, but like lwp_create() nothing else is set up until
+ * a thread's first dispatch (see slot_guard()).  The batch is admitted
+ * under a single timestamp.  Returns how many were created; tids_out
+ * (if given) gets their ids.
+ */
+size_t lwp_create_many(lwpfun f, void *args[], size_t n, tid_t tids_out[]){
+    if(!n) return 0;
+
+    thread *ts = (thread*)malloc(n * sizeof(*ts));
+    if(!ts) return 0;
+    size_t got = slab_alloc_array(&rt->tcb_slab, (void**)ts, n);
+
+    // in huge mode, or without the address space, stacks come one by one
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    size_t stksz  = default_stacksize();
+    size_t slot   = stksz + pagesz;
+    char *region = MAP_FAILED;
+    if(got && !rt->huge_kind)
+        region = (char*)mmap(NULL, got * slot, PROT_READ|PROT_WRITE,
+                             stack_map_flags() | MAP_NORESERVE, -1, 0);
+
     ensure_scheduler();
-    if(cur_sched && cur_sched->admit) cur_sched->admit(t);
+    unsigned long now = tsc_now();
+    for(size_t i = 0; i < got; i++){
+        thread t = ts[i];
+        if(region != MAP_FAILED){
+            t->stack     = (unsigned long*)(region + i * slot + pagesz);
+            t->stacksize = stksz;
+            t->flags    |= LWPF_NOGUARD;        // till slot_guard()
+        }
+        t->tid    = rt->next_tid++;
+        t->status = MKTERMSTAT(LWP_LIVE, 0);
+        t->entry  = f;
+        t->arg    = args ? args[i] : NULL;
+        register_thread(t);
+        if(rt->cur_sched && rt->cur_sched->admit) sched_admit_at(t, now);
+        if(tids_out) tids_out[i] = t->tid;
+    }
+    free(ts);
+    return got;
+}
+
+/* Create on caller-owned memory: nothing is allocated and nothing is
+ * mapped.  The thread is booted at once, as its memory is all there,
+ * and when lwp_wait() reaps it tcb and stack go back through release
+ * instead of to the slab and munmap.  The stack has no guard page.
+ */
+tid_t lwp_create_on(lwpfun f, void *arg, lwp_tcb *tcb, void *stack,
+                    size_t size, lwp_release release, void *release_arg){
+    if(!tcb || ((uintptr_t)tcb & 63) || !stack || size < 4096)
+        return NO_THREAD;
+
+    thread t = &tcb->ctx;
+    memset(t, 0, sizeof *t);
+    tcb->release     = release;
+    tcb->release_arg = release_arg;
+
+    t->tid       = rt->next_tid++;
+    t->status    = MKTERMSTAT(LWP_LIVE, 0);
+    t->flags     = LWPF_CALLER;
+    t->state     = &tcb->regs;
+    t->stack     = (unsigned long*)stack;
+    t->stacksize = size;
+    if(__builtin_expect(lwp_stack_paint, 0)) stack_paint(t);
+    boot_init(t, f, arg);
 
+    register_thread(t);
+    ensure_scheduler();
+    if(rt->cur_sched && rt->cur_sched->admit) sched_admit(t);
     return t->tid;
 }
 
+// Give a reaped thread's memory back to wherever it came from
+static void reap(thread t){
+    remove_thread_global(t);
+    if(t->flags & LWPF_CALLER){
+        lwp_tcb *u = (lwp_tcb*)t;
+        free(t->hist);
+        t->hist = NULL;
+        if(u->release) u->release(u, t->stack, t->stacksize, u->release_arg);
+        return;
+    }
+    release_stack(t);
+    tcb_free(t);
+}
+
+/* Blocking.  A blocked thread sits in no run queue until thread_wake()
+ * admits it again, or thread_handoff() has the caller's lwp_exit()
+ * switch straight to it.  It may also be resumed without either (when
+ * the queue runs dry scheduler_main gets the CPU), so callers re-check
+ * whatever they were waiting for.
+ */
+// The running thread, turning the caller into scheduler_main if needed
+thread self_thread(void){
+    ensure_scheduler();
+    if(!rt->scheduler_main && !new_main()) return NULL;
+    if(!rt->current) rt->current = rt->scheduler_main;
+    return rt->current;
+}
+
+// Block the running thread; -1 (at once) if nothing else could run
+int thread_block(void){
+    thread me = self_thread();
+    if(!me) return -1;
+    if(__builtin_expect(me->flags & LWPF_TASK, 0)) task_promote(me);
+    if(rt->cur_sched->remove) rt->cur_sched->remove(me);   // main may be queued
+    me->flags |= LWPF_BLOCKED;          // before sched_next() drains the inbox
+    thread next = rt->cur_sched->next ? sched_next() : NULL;
+    if(next == me) return 0;            // woken by that drain
+    if(!next && me != rt->scheduler_main) next = rt->scheduler_main;
+    if(!next){
+        me->flags &= ~LWPF_BLOCKED;
+        return -1;
+    }
+
+    ctx_switch(me, next);
+    me->flags &= ~LWPF_BLOCKED;                    // if nobody woke us
+    return 0;
+}
+
+void thread_wake(thread t){
+    if(!(t->flags & LWPF_BLOCKED)) return;
+    t->flags &= ~LWPF_BLOCKED;
+    sched_admit(t);
+}
+
+// Back on the queue after its group's quota held it (see lwp_group.c)
+void thread_unthrottle(thread t){
+    t->flags &= ~LWPF_THROTTLED;
+    sched_admit(t);
+}
+
+// Wake t by running it as soon as the calling thread exits
+void thread_handoff(thread t){
+    if(!(t->flags & LWPF_BLOCKED)) return;
+    t->flags &= ~LWPF_BLOCKED;
+    rt->exit_next = t;
+}
+
 // Exit: terminate the current thread
 void lwp_exit(int code){
-    thread me = current;
+    thread me = rt->current;
     if (!me) return;
 
+    if (__builtin_expect(me->flags & LWPF_TASK, 0)) task_promote(me);
+    if (me->flags & LWPF_KEYS) keys_exit(me);
+    if (__builtin_expect(me->flags & LWPF_PAINTED, 0)) stack_exit(me);
     me->status = MKTERMSTAT(LWP_TERM, code & 0xFF);
+    TRACE(LWP_EV_EXIT, me->tid, me->status);
+    STATS(stats_exit(me));
 
-    if (cur_sched && cur_sched->remove) cur_sched->remove(me);
-    if (me != scheduler_main) term_enqueue(me);
+    if (rt->cur_sched && rt->cur_sched->remove) rt->cur_sched->remove(me);
+    if (me != rt->scheduler_main){
+        if (me->flags & LWPF_DETACHED) rt->reap_pending = me;   // freed once off it
+        else                           term_enqueue(me);
+    }
 
     // Context switch to another thread
-    int live = 0;
-    for (glnode *p = ghead; p; p = p->next){
-        thread t = p->t;
-        if (t && t != scheduler_main && !LWPTERMINATED(t->status)) live++;
-    }
-    notify_reset_counts(live);
+    if (me != rt->scheduler_main) rt->live_count--;
+    notify_reset_counts((int)rt->live_count);
 
-    // Find next thread to run
-    thread next = (cur_sched && cur_sched->next) ? cur_sched->next() : NULL;
+    // Find next thread to run: a handoff target first
+    thread next = rt->exit_next;
+    rt->exit_next = NULL;
+    if(!next) next = (rt->cur_sched && rt->cur_sched->next) ? sched_next() : NULL;
 
     if(next == me){
-        next = (cur_sched && cur_sched->next) 
-            ? cur_sched->next() : NULL;
+        next = (rt->cur_sched && rt->cur_sched->next) 
+            ? sched_next() : NULL;
         if(next == me) next = NULL;
     }
 
     if (next){
-        current = next;
-        swap_rfiles(&me->state, &next->state);  /* does not return */
+        ctx_switch(me, next);                   /* does not return */
         return;
     }
 
-    if (scheduler_main){
-        current = scheduler_main;
-        swap_rfiles(&me->state, &scheduler_main->state); /* does not return */
+    if (rt->scheduler_main){
+        ctx_switch(me, rt->scheduler_main);         /* does not return */
     }
 }
 
 // Get TID of current thread (or NO_THREAD if none)
 tid_t lwp_gettid(void){
-  return current ? current->tid : NO_THREAD;
+  return rt->current ? rt->current->tid : NO_THREAD;
 }
 
-// Yield: voluntarily give up the CPU to another thread
-void lwp_yield(void){
+// The running thread itself, for the profiler's signal handler
+thread cur_thread(void){
+  return rt->current;
+}
+
+/* Yield: voluntarily give up the CPU to another thread.  If main finds
+ * nothing runnable while live LWPs are blocked, it idles (inbox_idle())
+ * only when idle is set: from lwp_wait(), which can't do anything else
+ * anyway.  A plain lwp_yield() returns, since main may be the one that
+ * is about to wake them.
+ */
+static void yield_cpu(int idle){
     ensure_scheduler();
 
     // Ensure main thread exists
-    if(!scheduler_main){
-        scheduler_main = (thread)calloc(1, sizeof(*scheduler_main));
-        if(!scheduler_main) return;
-        scheduler_main->tid    = next_tid++;
-        scheduler_main->status = MKTERMSTAT(LWP_LIVE, 0);
-        add_thread_global(scheduler_main);
-    }
+    if(!rt->scheduler_main && !new_main()) return;
 
     // Current thread (or main if none)
-    thread old = current ? current : scheduler_main;
+    thread old = rt->current ? rt->current : rt->scheduler_main;
+    if(__builtin_expect(old->flags & LWPF_TASK, 0)) task_promote(old);
 
     // Notification rotation handling
-    if (notify_need_live > 0 &&
-        old != scheduler_main &&
+    if (rt->notify_need_live > 0 &&
+        old != rt->scheduler_main &&
         !LWPTERMINATED(old->status))
     {
         if (notify_mark_seen(old->tid)) {
-            if (notify_seen_cnt >= notify_need_live) {
-                if (cur_sched && cur_sched->admit)    // keep old in RR
-                    cur_sched->admit(old);
+            if (rt->notify_seen_cnt >= rt->notify_need_live) {
+                if (rt->cur_sched && rt->cur_sched->admit)    // keep old in RR
+                    sched_admit(old);
                 notify_reset_counts(0);               // consume rotation
-                current = scheduler_main;             // wake main exactly once
-                swap_rfiles(&old->state, &scheduler_main->state);
+                ctx_switch(old, rt->scheduler_main);      // wake main exactly once
                 return;
             }
         }
     }
 
-    thread next = (cur_sched && cur_sched->next) ? cur_sched->next() : NULL;
+    /* Under quotas old is queued first, so that sched_next() can hold it
+     * if its group is out of budget (and pick it if it's all there is).
+     */
+    int queued = 0;
+    if(__builtin_expect(rt->groups.quotas != 0, 0) && old != rt->scheduler_main
+       && !LWPTERMINATED(old->status) && rt->cur_sched->admit){
+        sched_admit(old);
+        queued = 1;
+    }
+
+    thread next = (rt->cur_sched && rt->cur_sched->next) ? sched_next() : NULL;
+    if(!next && idle && old == rt->scheduler_main && rt->live_count > 0
+       && rt->cur_sched->next){
+        inbox_idle(&rt->inbox);         // the rest are all blocked
+        next = sched_next();
+    }
     if(!next){
-        if(old == scheduler_main) return;
+        if(old == rt->scheduler_main) return;
         if(!LWPTERMINATED(old->status)) return;
-        current = scheduler_main;
-        swap_rfiles(&old->state, &scheduler_main->state);
+        ctx_switch(old, rt->scheduler_main);
         return;
     }
     if(next == old){
         return;
     }
-    if(old != scheduler_main && !LWPTERMINATED(old->status) 
-        && next != old
-        && cur_sched->admit){
-        cur_sched->admit(old);
+    if(old != rt->scheduler_main && !LWPTERMINATED(old->status) 
+        && next != old && !queued
+        && rt->cur_sched->admit){
+        sched_admit(old);
     }
-    current = next;
-    swap_rfiles(&old->state, &current->state);
+    ctx_switch(old, next);
+}
+
+void lwp_yield(void){
+    yield_cpu(0);
 }
 
 // Start: begin scheduling threads
 void lwp_start(void){
-    if(scheduler_main) return;
+    if(rt->scheduler_main) return;
     ensure_scheduler();
 
-    scheduler_main = (thread)calloc(1, sizeof(*scheduler_main));
-    if(!scheduler_main) return;
-    scheduler_main->tid    = next_tid++;
-    scheduler_main->status = MKTERMSTAT(LWP_LIVE, 0);
-    add_thread_global(scheduler_main);
+    if(!new_main()) return;
 
-    current = scheduler_main;
+    rt->current = rt->scheduler_main;
     lwp_yield();
 }
 
 // Wait: wait for any thread to terminate; 
-tid_t lwp_wait(int *status){
+// Run others until the terminated FIFO is non-empty; -1 if it never will be
+static int wait_for_term(void){
     ensure_scheduler();
 
-    if(!scheduler_main){
-        scheduler_main = (thread)calloc(1, sizeof(*scheduler_main));
-        if(!scheduler_main) return NO_THREAD;
-        scheduler_main->tid    = next_tid++;
-        scheduler_main->status = MKTERMSTAT(LWP_LIVE, 0);
-        add_thread_global(scheduler_main);
-        current = scheduler_main;
+    if(!rt->scheduler_main){
+        if(!new_main()) return -1;
+        rt->current = rt->scheduler_main;
     }
 
     // Run until someone finishes or no live LWPs remain
-    while(!term_head){
-        thread before = current;
-        lwp_yield();
+    while(!rt->term_head){
+        thread before = rt->current;
+        yield_cpu(1);
 
-        if(!term_head && current == before){
+        if(!rt->term_head && rt->current == before){
             // No context switch happened; check if any live LWPs exist
-            int any_live = 0;
-            for (glnode *p = ghead; p; p = p->next){
-                thread t = p->t;
-                if (t && t != scheduler_main && !LWPTERMINATED(t->status)){
-                    any_live = 1; break;
-                }
-            }
-            if(!any_live) return NO_THREAD;
+            if(rt->live_count <= 0) return -1;
         }
     }
+    return 0;
+}
+
+tid_t lwp_wait(int *status){
+    if(wait_for_term()) return NO_THREAD;
 
     // A thread finished:
     thread t = term_dequeue();
     tid_t tid = t->tid;
     if(status) *status = t->status;
+    TRACE(LWP_EV_WAIT, lwp_gettid(), tid);
+    STATS(stats_detach(t));
 
-    if(t != scheduler_main){
-        if(t->stack && t->stacksize) munmap((void*)t->stack, t->stacksize);
+    if(t != rt->scheduler_main) reap(t);
+    return tid;
+}
+
+/* Free a list of reaped threads (linked through exited).  Stacks that
+ * don't fit in the stack_keep pool are unmapped, but neighbouring ones
+ * (lwp_create_many() lays them out back to back) in one munmap.
+ */
+static void reap_batch(thread list){
+    char *lo = NULL, *hi = NULL;          // run of adjacent slots to unmap
+    while(list){
+        thread t = list;
+        list = t->exited;
+        if(t->flags & (LWPF_CALLER|LWPF_SHARED|LWPF_HUGE) || !t->stack
+           || stack_keepable(t)){
+            reap(t);
+            continue;
+        }
+        char *a = (char*)t->stack - below_stack(t);
+        char *b = (char*)t->stack + t->stacksize;
+        if(a == hi) hi = b;
+        else if(b == lo) lo = a;
+        else {
+            if(lo) munmap(lo, (size_t)(hi - lo));
+            lo = a;
+            hi = b;
+        }
         remove_thread_global(t);
-        free(t);
+        tcb_free(t);
     }
-    return tid;
+    if(lo) munmap(lo, (size_t)(hi - lo));
+}
+
+/* Wait for up to max threads at once.  Blocks like lwp_wait() until at
+ * least one has exited (unless LWP_WNOHANG), then takes everything
+ * already on the terminated FIFO, oldest first, up to max.  Returns how
+ * many; tids[i] and statuses[i] (if given) are what lwp_wait() would
+ * have returned in turn.
+ */
+size_t lwp_wait_many(tid_t *tids, int *statuses, size_t max, int flags){
+    if(!max || !tids) return 0;
+    if(!(flags & LWP_WNOHANG) && wait_for_term()) return 0;
+
+    thread batch = NULL;
+    size_t n = 0;
+    while(n < max && rt->term_head){
+        thread t = term_dequeue();
+        tids[n] = t->tid;
+        if(statuses) statuses[n] = t->status;
+        TRACE(LWP_EV_WAIT, lwp_gettid(), t->tid);
+        STATS(stats_detach(t));
+        t->exited = batch;
+        batch = t;
+        n++;
+    }
+    reap_batch(batch);
+    return n;
+}
+
+// Take an exited thread out of the terminated FIFO, wherever it is
+static int term_unlink(thread t){
+    thread prev = NULL;
+    for(thread p = rt->term_head; p; prev = p, p = p->exited){
+        if(p != t) continue;
+        if(prev) prev->exited = t->exited;
+        else     rt->term_head = t->exited;
+        if(rt->term_tail == t) rt->term_tail = prev;
+        t->exited = NULL;
+        return 0;
+    }
+    return -1;
+}
+
+/* Detach: nobody will wait for tid.  Its control block and stack are
+ * freed as soon as it has exited and is off its stack; one that has
+ * already exited is freed right here.
+ */
+int lwp_detach(tid_t tid){
+    thread t = tid2thread(tid);
+    if(!t || t == rt->scheduler_main) return -1;
+    t->flags |= LWPF_DETACHED;
+    if(LWPTERMINATED(t->status) && !term_unlink(t)){
+        STATS(stats_detach(t));
+        reap(t);
+    }
+    return 0;
 }
 
 // Set the current scheduler, migrating threads as needed
 void lwp_set_scheduler(scheduler newsched){
   ensure_scheduler();
   if(!newsched) newsched = rr_scheduler();
-  if(newsched == cur_sched) return;
+  if(newsched == rt->cur_sched) return;
 
   if(newsched->init) newsched->init();
 
-  scheduler old = cur_sched;
+  scheduler old = rt->cur_sched;
 
   if(old){
 
     // Migrate all threads except scheduler_main and current
-    for (glnode *n = ghead; n; n = n->next) {
-      thread t = n->t;
-      if (!t) continue;
-      if (t == scheduler_main) continue;
-      if (t == current)        continue;
+    for (thread t = rt->ghead; t; t = t->lib_one) {
+      if (t == rt->scheduler_main) continue;
+      if (t == rt->current)        continue;
       if (LWPTERMINATED(t->status)) continue;
+      if (t->flags & (LWPF_BLOCKED|LWPF_THROTTLED)) continue;
 
       if (old->remove) old->remove(t);
       if (newsched->admit) newsched->admit(t);
@@ -367,16 +1107,143 @@ void lwp_set_scheduler(scheduler newsched){
     if (old->shutdown) old->shutdown();
   }
 
-  cur_sched = newsched;
+  TRACE(LWP_EV_SCHED, (unsigned long)old, (unsigned long)newsched);
+  rt->cur_sched = newsched;
+  rt->cur_hist  = NULL;
 
   // If no current thread, yield to scheduler_main
-  if (!current || current == scheduler_main) {
+  if (!rt->current || rt->current == rt->scheduler_main) {
     lwp_yield();
   }
 }
 
 // Get the current scheduler, initializing default if needed
 scheduler lwp_get_scheduler(void){
-  if(!cur_sched) cur_sched = rr_scheduler();
-  return cur_sched;
-}
\ No newline at end of file
+  if(!rt->cur_sched) rt->cur_sched = rr_scheduler();
+  return rt->cur_sched;
+}
+
+// Turn per-thread wait histograms on or off (off frees nothing)
+void lwp_hist_per_thread(int on){
+  hist_threads = on;
+}
+
+// Snapshot one thread's wait histogram
+int lwp_hist_thread(tid_t tid, lwp_hist *out){
+  thread t = tid2thread(tid);
+  if (!t || !t->hist) return -1;
+  if (out) memcpy(out, t->hist, sizeof *out);
+  return 0;
+}
+
+// Zero every scheduler and per-thread histogram
+void lwp_hist_reset(void){
+  hist_reset_scheds();
+  for (thread t = rt->ghead; t; t = t->lib_one)
+    if (t->hist) memset(t->hist, 0, sizeof *t->hist);
+}
+
+// Publish counters into a shared-memory segment for lwptop
+int lwp_stats_publish(const char *name){
+  if (lwp_stats) return 0;
+  if (stats_open(name)) return -1;
+  for (thread t = rt->ghead; t; t = t->lib_one)
+    stats_attach(t, t != rt->scheduler_main && !LWPTERMINATED(t->status));
+  return 0;
+}
+
+// The bound runtime's pieces that live in other modules
+rr_queue *rt_rr(void){
+  return &rt->rr;
+}
+
+lwp_inbox *rt_inbox(void){
+  return &rt->inbox;
+}
+
+sched_hist *rt_hists(void){
+  return rt->hists;
+}
+
+park_bucket *rt_park(void){
+  return rt->park;
+}
+
+group_table *rt_groups(void){
+  return &rt->groups;
+}
+
+task_queue *rt_tasks(void){
+  return &rt->tasks;
+}
+
+lwp_inbox *runtime_inbox(lwp_runtime *r){
+  return &(r ? r : &default_rt)->inbox;
+}
+
+// The inbox of the runtime tid belongs to, from any OS thread
+lwp_inbox *tid_inbox(tid_t tid){
+  unsigned long id = tid >> RT_SHIFT;
+  lwp_runtime *r = id < LWP_RUNTIMES_MAX
+                 ? __atomic_load_n(&runtimes[id], __ATOMIC_ACQUIRE) : NULL;
+  return r ? &r->inbox : NULL;
+}
+
+lwp_runtime *lwp_runtime_create(void){
+  unsigned id = __atomic_fetch_add(&nruntimes, 1, __ATOMIC_RELAXED);
+  if (id >= LWP_RUNTIMES_MAX) return NULL;
+  lwp_runtime *r;
+  if (posix_memalign((void**)&r, 64, sizeof *r)) return NULL;
+  memset(r, 0, sizeof *r);
+
+  slab_cache tcb = SLAB_CACHE(context, 64), rf = SLAB_CACHE(rfile, 64);
+  r->tcb_slab   = tcb;
+  r->rfile_slab = rf;
+  r->id         = id;
+  r->next_tid   = ((tid_t)id << RT_SHIFT) + 1;
+  inbox_init(&r->inbox);
+  __atomic_store_n(&runtimes[id], r, __ATOMIC_RELEASE);
+  return r;
+}
+
+// Bind the calling OS thread to r (NULL: the default); returns the old one
+lwp_runtime *lwp_runtime_bind(lwp_runtime *r){
+  lwp_runtime *old = rt;
+  rt = r ? r : &default_rt;
+  stack_guard_init();                   // this pthread's signal stack
+  return old;
+}
+
+lwp_runtime *lwp_runtime_current(void){
+  return rt;
+}
+
+/* Free a runtime with no threads left.  Its stack pool and shared stacks
+ * are unmapped; its slabs, like all slabs, are not given back.  Nobody
+ * may still be posting to it.
+ */
+int lwp_runtime_destroy(lwp_runtime *r){
+  if (!r || r == &default_rt || r == rt) return -1;
+  if (r->live_count > 0 || r->term_head) return -1;
+  __atomic_store_n(&runtimes[r->id], NULL, __ATOMIC_RELEASE);
+
+  lwp_runtime *old = lwp_runtime_bind(r);
+  if (rt->cur_sched && rt->cur_sched->shutdown) rt->cur_sched->shutdown();
+  size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+  while (rt->stack_keep){
+    unsigned long *stk = rt->stack_keep;
+    rt->stack_keep = *(unsigned long**)stk;
+    munmap((char*)stk - pagesz, default_stacksize() + pagesz);
+  }
+  sstack_unmap(rt->groups.none.sstack);
+  for (int i = 0; i < GROUP_BUCKETS; i++)
+    for (lwp_group *g = rt->groups.bucket[i]; g; g = g->hnext)
+      sstack_unmap(g->sstack);
+  if (rt->sstack_helper) munmap(rt->sstack_helper->stack, SSTACK_HELPER_SIZE);
+  lwp_runtime_bind(old);
+
+  inbox_fini(&r->inbox);
+  groups_fini(&r->groups);
+  free(r);
+  return 0;
+}
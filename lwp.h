@@ -1,6 +1,7 @@
 #ifndef LWPH
 #define LWPH
 #include <sys/types.h>
+#include <stdio.h>
 
 #ifndef TRUE
 #define TRUE 1
@@ -42,21 +43,98 @@ typedef char _fxsave_align_check[(offsetof(rfile, fxsave) % 16) == 0 ? 1 : -1];
 typedef unsigned long tid_t;
 #define NO_THREAD 0             // An always invalid thread id
 
+// Run-queue wait histogram (admit -> dispatch), recorded in TSC ticks
+#define LWP_HIST_SUBBITS  3
+#define LWP_HIST_BUCKETS  ((64 - LWP_HIST_SUBBITS + 1) << LWP_HIST_SUBBITS)
+typedef struct lwp_hist {
+  unsigned long count;          // samples recorded
+  unsigned long max;            // largest sample (ticks)
+  unsigned long bucket[LWP_HIST_BUCKETS];
+} lwp_hist;
+
+// Per-LWP performance counters (see lwp_pmc_name() for what each is)
+#define LWP_PMC_MAX  4
+#define LWP_PMC_HW   1          // cycles, instructions, cache/branch misses
+#define LWP_PMC_SW   2          // software fallback: task-clock etc.
+typedef struct lwp_pmc { unsigned long v[LWP_PMC_MAX]; } lwp_pmc;
+
+typedef int (*lwpfun)(void *);  // type for lwp function
+
+#define LWP_KEYS_INLINE 4       // key values kept in the control block
+
 typedef struct threadinfo_st *thread;
-typedef struct threadinfo_st {
+/* Thread control block.  The fields the dispatch path touches (tid,
+ * status, queue links, the register-file pointer) are packed into the
+ * first cache line; everything else follows.  The 640-byte register
+ * file lives in its own slab so walking a queue never drags it in.
+ * A thread made by lwp_create() that has never run has no register
+ * file and no stack yet (state == NULL): both are set up on its first
+ * dispatch from entry/arg.
+ */
+typedef struct __attribute__ ((aligned(64))) threadinfo_st {
   tid_t         tid;            // lwp id
-  unsigned long *stack;         // Base stack
-  size_t        stacksize;      // Size stack
-  rfile         state;          // saved registers
   unsigned int  status;         // status
-  thread        lib_one;
-  thread        lib_two;
-  thread        sched_one;
+  unsigned int  flags;          // library-private LWPF_* bits
+  thread        sched_one;      // for the scheduler's use
   thread        sched_two;
+  rfile         *state;         // saved registers
+  unsigned long admit_tsc;      // when last admitted (0 = not queued)
+  thread        lib_one;        // for the library's use
+  thread        lib_two;
+  /* ---- cold ---- */
   thread        exited;         // One for lwp_wait()
+  unsigned long *stack;         // Base stack
+  size_t        stacksize;      // Size stack
+  size_t        guardsize;      // PROT_NONE bytes just below stack
+  lwp_hist      *hist;          // per-thread wait histogram, or NULL
+  unsigned int  stat_slot;      // stats segment slot + 1 (0 = none)
+  unsigned int  keys_cap;       // slots in keys_more
+  unsigned long pmc[LWP_PMC_MAX]; // counter deltas charged to this thread
+  lwpfun        entry;          // f(arg) the thread runs
+  void          *arg;
+  void          *save;          // shared-stack threads: frames while off it
+  size_t        savelen;        // bytes of live stack in save
+  size_t        savecap;
+  size_t        stack_hw;       // deepest stack use, set at exit if painted
+  void          *coro;          // innermost coroutine it is running, if any
+  void          *keys[LWP_KEYS_INLINE]; // lwp_getspecific() values...
+  void          **keys_more;    // ...and those past the inline slots
+  unsigned int  group;          // lwp_set_group() id, 0 = none
+  thread        held_next;      // on its group's held list, if throttled
 } context;
 
-typedef int (*lwpfun)(void *);  // type for lwp function
+/* Compile-time guard: the hot fields must fit in one cache line */
+typedef char _hot_line_check[offsetof(context, exited) <= 64 ? 1 : -1];
+
+/* Caller-owned memory for lwp_create_on(): control block, register file
+ * and the callback that hands it back (with the stack) once the thread
+ * has been reaped.  Must be 64-byte aligned, as the type is.
+ */
+typedef struct lwp_tcb lwp_tcb;
+typedef void (*lwp_release)(lwp_tcb *tcb, void *stack, size_t size, void *arg);
+struct lwp_tcb {
+  context       ctx;
+  rfile         regs;
+  lwp_release   release;
+  void          *release_arg;
+};
+
+// Creation attributes for lwp_create_attr()
+#define LWP_ATTR_SHARED_STACK 0x1   // run on the shared stack (see below)
+#define LWP_ATTR_DETACHED     0x2   // never waited for; freed at exit
+typedef struct lwp_attr {
+  unsigned int flags;           // LWP_ATTR_*
+  size_t       stacksize;       // 0: the default (1 MiB)
+} lwp_attr;
+
+/* LWP_ATTR_SHARED_STACK threads execute on a stack shared by their
+ * group (see lwp_set_group(); the one they were in when they first
+ * ran).  When one is switched out for another of its group only the
+ * live part of its stack (saved rsp up to the top) is copied to a heap
+ * buffer, and copied back when it next runs, so an idle thread costs
+ * its real stack depth instead of a mapping.  stacksize is ignored for
+ * them: shared stacks have the default size.
+ */
 
 // Tuple that describes a scheduler
 typedef struct scheduler {
@@ -70,15 +148,270 @@ typedef struct scheduler {
 
 // lwp functions
 extern tid_t lwp_create(lwpfun,void *);
+extern tid_t lwp_create_attr(lwpfun, void *, const lwp_attr *);
+extern size_t lwp_create_many(lwpfun, void *args[], size_t n, tid_t tids_out[]);
+extern tid_t lwp_create_on(lwpfun, void *, lwp_tcb *tcb, void *stack,
+                           size_t size, lwp_release release, void *release_arg);
 extern void  lwp_exit(int status);
 extern tid_t lwp_gettid(void);
 extern void  lwp_yield(void);
 extern void  lwp_start(void);
 extern tid_t lwp_wait(int *);
+extern int   lwp_detach(tid_t tid);
+#define LWP_WNOHANG 1           // lwp_wait_many: don't wait if none exited
+extern size_t lwp_wait_many(tid_t *tids, int *statuses, size_t max, int flags);
 extern void  lwp_set_scheduler(scheduler fun);
 extern scheduler lwp_get_scheduler(void);
 extern thread tid2thread(tid_t tid);
 
+/* futures: lwp_spawn() runs fn(arg) in a new (detached) LWP and keeps
+ * its return value for one lwp_await*() call, which blocks the caller
+ * until it is there.  A completed future goes back to a pool once its
+ * result has been taken.  Each future may have one awaiting thread.
+ * The await calls return NULL / n if nothing left could ever finish it.
+ */
+typedef void *(*lwp_task)(void *);
+typedef struct lwp_future *lwp_future;
+extern lwp_future lwp_spawn(lwp_task fn, void *arg);
+extern int    lwp_future_ready(lwp_future f);
+extern void  *lwp_await(lwp_future f);
+extern void   lwp_await_all(lwp_future fs[], size_t n, void *results[]);
+extern size_t lwp_await_any(lwp_future fs[], size_t n, void **result);
+
+/* asymmetric coroutines.  lwp_coro_resume() switches straight from the
+ * calling LWP to the coroutine and lwp_coro_yield() straight back; no
+ * scheduler is involved.  The first resume's value is fn's argument,
+ * later ones are what lwp_coro_yield() returns; what the coroutine
+ * yields (or finally returns) is what lwp_coro_resume() returns.  A
+ * coroutine runs as part of the LWP that resumed it (lwp_gettid() is
+ * that LWP's) and shouldn't be resumed from a shared-stack LWP.
+ */
+typedef void *(*lwp_corofun)(void *);
+typedef struct lwp_coro *lwp_coro;
+extern lwp_coro lwp_coro_create(lwp_corofun fn, size_t stacksize); // 0: default
+extern void *lwp_coro_resume(lwp_coro co, void *in);
+extern void *lwp_coro_yield(void *out);
+extern int   lwp_coro_done(lwp_coro co);
+extern void  lwp_coro_destroy(lwp_coro co);
+
+/* LWP-local storage.  The first LWP_KEYS_INLINE keys live in the
+ * control block; later ones in a per-thread array grown on first set.
+ * A value's destructor runs when its thread calls lwp_exit() (or
+ * returns), as long as the value isn't NULL; destructors that set
+ * values again get up to LWP_KEYS_DTOR_ROUNDS passes.
+ */
+#define LWP_KEYS_MAX        1024
+#define LWP_KEYS_DTOR_ROUNDS 4
+typedef unsigned int lwp_key_t;
+extern int   lwp_key_create(lwp_key_t *key, void (*dtor)(void *));
+extern void *lwp_getspecific(lwp_key_t key);
+extern int   lwp_setspecific(lwp_key_t key, const void *value);
+
+/* posting from other OS threads.  These two may be called from any
+ * pthread at any time (nothing else in the library may).  The message
+ * is queued and acted on by the LWP side at its next dispatch:
+ * lwp_post_wakeup() makes the LWP's lwp_suspend() return (or its next
+ * one, if it isn't suspended yet; wakeups don't count up), and
+ * lwp_post_task() runs fn(arg) in a new detached LWP.  Wakeups for a
+ * tid that has exited are dropped.
+ */
+extern int lwp_post_wakeup(tid_t tid);
+extern int lwp_post_task(lwpfun fn, void *arg);     // to the default runtime
+extern int lwp_suspend(void);
+
+/* idle policy: what lwp_wait() and lwp_suspend() do when nothing is
+ * runnable but live LWPs are blocked, which only a post can end.
+ * (lwp_yield() just returns then: its caller may still wake them.)
+ * SPIN polls for posts and never sleeps; SPIN_PARK polls `spins` times
+ * and then sleeps on an eventfd that the next post wakes; PARK sleeps
+ * at once.  The default is SPIN_PARK, 1000.
+ */
+#define LWP_IDLE_SPIN      0
+#define LWP_IDLE_SPIN_PARK 1
+#define LWP_IDLE_PARK      2
+extern void lwp_set_idle(int policy, unsigned long spins);
+
+/* parking lot: wait on any int without a wait queue in it.  Waiters
+ * are kept in a small hash table (per runtime) keyed by address, on
+ * nodes taken from a slab only while they wait, so a lock word costs
+ * nothing but itself.  lwp_park() blocks the caller if *addr still holds
+ * expected -- the check and the park are atomic, since nothing else in
+ * the runtime runs in between -- and returns 0 when woken (or
+ * spuriously: re-check), 1 if *addr didn't hold expected, -1 if
+ * nothing else could ever run to wake it.  The unpark calls return how
+ * many they woke.
+ */
+extern int    lwp_park(const int *addr, int expected);
+extern size_t lwp_unpark_one(const void *addr);
+extern size_t lwp_unpark_all(const void *addr);
+
+/* run-to-completion tasks: lwp_submit() queues fn(arg) to be called
+ * straight from a dispatcher LWP, one after another on its stack, with
+ * no stack or registers of their own.  A task that blocks (yields,
+ * parks, waits, ...) or exits is promoted on the spot: it keeps the
+ * dispatcher's stack as an LWP of its own and a new dispatcher takes
+ * over the queue.  fn's return value is ignored.  Until it is promoted
+ * a task has the dispatcher's lwp_gettid(), but not its LWP-local
+ * keys: the slots are emptied, destructors run, after every task.
+ */
+extern int lwp_submit(lwpfun fn, void *arg);
+
+/* locality groups: a hint that some LWPs share a working set.  Under
+ * lwp_group_scheduler() the runnable members of a group run back to
+ * back; groups take turns in rotation and each member runs once per
+ * turn, so every thread gets the same share it would under RR.  A new
+ * LWP starts in its creator's group; group 0 (no group) is a group too.
+ */
+extern int       lwp_set_group(tid_t tid, unsigned int gid);  // -1: bad tid
+extern unsigned  lwp_get_group(tid_t tid);
+extern scheduler lwp_group_scheduler(void);
+
+/* CPU quotas per group: budget_us of CPU in every period_us (budget 0
+ * lifts the quota).  Whenever the scheduler is consulted, the time
+ * since the last time is charged, in TSC ticks, to the group of the LWP
+ * that ran; a group out of budget is throttled, and its members are
+ * held off the run queue, whatever the scheduler, until its period
+ * rolls over.  LWPs can't be stopped mid-run, so an overrun is carried
+ * into the following periods.  With nothing but throttled LWPs left
+ * the runtime sleeps until the first refill.  Usage is counted for all
+ * groups while any group in the runtime has a quota.
+ */
+typedef struct lwp_group_stats {
+  unsigned long usage_ns;       // CPU charged to the group
+  unsigned long throttles;      // times it ran out of budget
+  unsigned long throttled_ns;   // time spent throttled
+  unsigned long held;           // members held off the queue right now
+} lwp_group_stats;
+extern int lwp_group_quota(unsigned int gid, unsigned long budget_us,
+                           unsigned long period_us);
+extern int lwp_group_usage(unsigned int gid, lwp_group_stats *out);
+
+/* runtimes.  A runtime is a complete, independent set of LWPs: its own
+ * threads, scheduler queue, stacks and allocator caches, and its own
+ * inbox.  Every call above works on the calling OS thread's bound
+ * runtime, which is the default one until lwp_runtime_bind() says
+ * otherwise, so pthreads that each bind a runtime of their own run
+ * their LWPs without sharing anything.  A runtime must only be used by
+ * one OS thread at a time and its LWPs never move to another runtime.
+ * Tids carry their runtime's id, so lwp_post_wakeup() finds the right
+ * one; lwp_runtime_post() is lwp_post_task() for a given runtime.
+ *
+ * The diagnostics (tracing, stats segment, profiler, perf counters,
+ * stack watermarks) are process-wide: use them with one runtime.
+ */
+typedef struct lwp_runtime lwp_runtime;
+#define LWP_RUNTIMES_MAX 1024
+extern lwp_runtime *lwp_runtime_create(void);
+extern lwp_runtime *lwp_runtime_bind(lwp_runtime *rt);  // NULL: default; old
+extern lwp_runtime *lwp_runtime_current(void);
+extern int  lwp_runtime_destroy(lwp_runtime *rt);       // -1 if still in use
+extern int  lwp_runtime_post(lwp_runtime *rt, lwpfun fn, void *arg);
+
+// run-queue latency histograms
+extern int  lwp_hist_sched(scheduler s, lwp_hist *out);
+extern int  lwp_hist_thread(tid_t tid, lwp_hist *out);
+extern void lwp_hist_per_thread(int on);
+extern void lwp_hist_reset(void);
+extern unsigned long lwp_hist_quantile(const lwp_hist *h, double q); // ns
+extern unsigned long lwp_hist_value(const lwp_hist *h, double q);    // raw
+extern void lwp_hist_print(FILE *out, const char *label, const lwp_hist *h);
+extern void lwp_hist_dump(FILE *out);
+
+// context-switch event tracing
+#define LWP_EV_CREATE   1       // a = new tid,   b = creator tid
+#define LWP_EV_SWITCH   2       // a = out tid,   b = in tid
+#define LWP_EV_EXIT     3       // a = tid,       b = status
+#define LWP_EV_WAIT     4       // a = waiter,    b = reaped tid
+#define LWP_EV_SCHED    5       // a = old sched, b = new sched
+typedef struct lwp_trace_ev {
+  unsigned long tsc;            // raw TSC
+  unsigned int  type;           // LWP_EV_*
+  unsigned int  pad;
+  unsigned long a, b;
+} lwp_trace_ev;
+
+#define LWP_TRACE_MAGIC "LWPTRC01"
+typedef struct lwp_trace_hdr {  // file header written by lwp_trace_save()
+  char          magic[8];
+  double        tsc_hz;
+  unsigned long count;          // events that follow
+  unsigned long dropped;        // events lost to ring wrap-around
+} lwp_trace_hdr;
+
+extern int  lwp_trace_start(size_t nevents);
+extern void lwp_trace_stop(void);
+extern int  lwp_trace_save(const char *path);
+
+// shared-memory stats segment (read by tools/lwptop)
+#define LWP_STATS_MAGIC   0x535441545350574cUL  // "LWPSTATS"
+#define LWP_STATS_VERSION 1
+#define LWP_STATS_SLOTS   4096
+#define LWP_ST_FREE       0
+#define LWP_ST_READY      1
+#define LWP_ST_RUNNING    2
+#define LWP_ST_EXITED     3
+typedef struct lwp_stats_thr {
+  unsigned long tid;
+  unsigned long state;          // LWP_ST_*
+  unsigned long switches;       // times dispatched
+  unsigned long run_tsc;        // ticks spent on the CPU
+} lwp_stats_thr;
+
+typedef struct lwp_stats_seg {
+  unsigned long magic;
+  unsigned long version;
+  unsigned long seq;            // seqlock: odd while being written
+  unsigned long pid;
+  double        tsc_hz;
+  unsigned long tsc;            // time of last update
+  unsigned long switches;
+  unsigned long creates;        // LWPs, not main: creates - exits are live
+  unsigned long exits;
+  unsigned long reaps;
+  unsigned long qlen;           // refreshed at most once per millisecond
+  unsigned long nslots;         // slots ever used (scan limit)
+  unsigned long overflow;       // threads that did not get a slot
+  lwp_stats_thr thr[LWP_STATS_SLOTS];
+} lwp_stats_seg;
+
+extern int  lwp_stats_publish(const char *name);   // NULL: "/lwp-<pid>"
+extern void lwp_stats_unpublish(void);
+
+// SIGPROF sampling profiler (folded-stack output)
+#define LWP_PROF_DEPTH 32
+extern int    lwp_prof_start(int hz, size_t max_samples);
+extern void   lwp_prof_stop(void);
+extern size_t lwp_prof_count(tid_t tid);     // NO_THREAD: all samples
+extern void   lwp_prof_dump(FILE *out);
+
+/* stack overflow detection and depth profiling.  Every LWP stack has a
+ * guard page below it, and a SIGSEGV there is reported (tid, entry,
+ * stack size) from a handler on an alternate signal stack before the
+ * process dies as it would have anyway.  With the watermark on, stacks
+ * set up from then on are painted, and each thread's deepest use is
+ * measured when it exits (shared-stack threads are not measured).
+ */
+extern void   lwp_stack_watermark(int on);   // costs a full stack fault-in
+extern long   lwp_stack_used(tid_t tid);     // bytes, -1 if not painted
+extern int    lwp_stack_hist(lwpfun entry, lwp_hist *out);  // bytes at exit
+extern void   lwp_stack_dump(FILE *out);
+
+/* huge-page arenas.  While on, new control blocks, register files and
+ * stacks are carved out of 2 MiB huge pages (MAP_HUGETLB if the system
+ * has reserved any, otherwise transparent huge pages), so threads with
+ * small stacks share huge pages and TLB entries.  Those stacks have no
+ * guard page: a huge page can't be partly protected.
+ */
+#define LWP_HUGE_TLB 1
+#define LWP_HUGE_THP 2
+extern int lwp_hugepages(int on);            // LWP_HUGE_*, 0 if off/none
+
+// per-LWP perf counters, sampled at every context switch
+extern int  lwp_pmc_enable(void);            // LWP_PMC_HW/SW, -1 if none
+extern void lwp_pmc_disable(void);
+extern int  lwp_pmc_read(tid_t tid, lwp_pmc *out);
+extern const char *lwp_pmc_name(int i);
+
 // for lwp_wait 
 #define TERMOFFSET        8
 #define MKTERMSTAT(a,b)   ( (a)<<TERMOFFSET | ((b) & ((1<<TERMOFFSET)-1)) )
@@ -90,4 +423,129 @@ extern thread tid2thread(tid_t tid);
 // prototypes for asm functions
 void swap_rfiles(rfile *old, rfile *new);
 
+// internals shared between library modules
+#define LWPF_SHARED 0x1         // runs on the shared stack
+#define LWPF_PAINTED 0x2        // stack painted for lwp_stack_used()
+#define LWPF_CALLER  0x4        // lwp_create_on(): memory is the caller's
+#define LWPF_HUGE    0x8        // stack from a huge-page stack cache
+#define LWPF_DETACHED 0x10      // reaped by the library at exit
+#define LWPF_BLOCKED 0x20       // off every run queue until woken
+#define LWPF_KEYS    0x40       // has had lwp_setspecific() values
+#define LWPF_SUSPENDED 0x80     // blocked in lwp_suspend()
+#define LWPF_POSTED  0x100      // a posted wakeup not yet consumed
+#define LWPF_TASK    0x200      // running a task on the dispatcher
+#define LWPF_THROTTLED 0x400    // held off the queue by its group's quota
+#define LWPF_NOGUARD 0x800      // page below the stack is mapped but unprotected
+extern void      hist_record(lwp_hist *h, unsigned long ticks);
+extern lwp_hist *hist_for(scheduler s);
+extern void      hist_reset_scheds(void);
+extern int       lwp_trace_on;
+extern void      trace_emit(unsigned type, unsigned long a, unsigned long b);
+extern void      trace_emit_at(unsigned long tsc, unsigned type,
+                                unsigned long a, unsigned long b);
+extern thread    cur_thread(void);
+extern thread    self_thread(void);
+extern thread    ctx_new(lwpfun f, void *arg, size_t stacksize);
+extern void      ctx_free(thread t);
+extern int       thread_block(void);
+extern void      thread_wake(thread t);
+extern void      thread_handoff(thread t);
+extern int       lwp_pmc_on;
+extern void      pmc_switch(thread t);
+extern lwp_stats_seg *lwp_stats;
+extern int       stats_open(const char *name);
+extern void      stats_attach(thread t, int counted);
+extern void      stats_detach(thread t);
+extern void      stats_switch(thread old, thread next);
+extern void      stats_exit(thread t);
+extern int       lwp_stack_paint;
+extern void      stack_guard_init(void);
+extern void      stack_paint(thread t);
+extern void      stack_exit(thread t);
+extern void      keys_clear(thread t);
+extern void      keys_exit(thread t);
+
+/* per-runtime state that lives outside lwp.c: the RR queue, the inbox
+ * (producers write head, the owning runtime everything else, so head
+ * gets a line of its own) and the run-queue wait histograms
+ */
+typedef struct rr_queue { thread head, tail; int count; } rr_queue;
+struct inbox_msg {
+  struct inbox_msg *next;
+  tid_t            tid;         // wakeup: whom
+  lwpfun           fn;          // task: what to run, or NULL
+  void             *arg;
+};
+typedef struct lwp_inbox {
+  struct inbox_msg *head __attribute__((aligned(64)));
+  struct inbox_msg *tail __attribute__((aligned(64)));
+  struct inbox_msg stub;
+  int              fd;          // eventfd, created on first park
+  int              sleeping;    // the owner may be blocked in read()
+} lwp_inbox;
+#define HIST_SCHEDS 8
+typedef struct sched_hist { scheduler s; lwp_hist h; } sched_hist;
+/* Per-runtime group records (lwp_group.c), made on first use and kept
+ * until the runtime goes; gid 0's is built in.  The group scheduler
+ * queues a group's runnable members on it, through sched_one/two, and
+ * links the groups that have any into a ring.
+ */
+#define GROUP_BUCKETS 64
+typedef struct lwp_group {
+  unsigned int     gid;
+  struct lwp_group *hnext;          // hash chain
+  thread           head, tail;      // runnable members
+  int              count;
+  struct lwp_group *ring_next, *ring_prev;
+  unsigned long    budget, period;  // quota, in ticks; budget 0: none
+  unsigned long    period_end;      // when the current period ends
+  unsigned long    used;            // charged this period (and overrun)
+  unsigned long    used_total;
+  unsigned long    throttles, throttled_ticks, throttled_at;
+  thread           held_head, held_tail;  // members held while throttled
+  unsigned long    nheld;
+  struct lwp_group *throttled_next; // on the table's throttled list
+  int              throttled;
+  struct sstack    *sstack;         // shared stack (lwp.c), NULL till used
+} lwp_group;
+typedef struct group_table {
+  lwp_group *bucket[GROUP_BUCKETS];
+  lwp_group none;                   // gid 0
+  lwp_group *turn;                  // group being run, NULL if none
+  int       turn_left;              // its dispatches left this turn
+  int       count;                  // runnable, over all groups
+  int       quotas;                 // groups with a quota
+  unsigned long charged_at;         // tsc of the last quota charge
+  lwp_group *throttled;             // groups out of budget
+} group_table;
+// lwp_submit()'s queue (lwp_submit.c), per runtime
+typedef struct task_queue {
+  struct task_rec *head, *tail;
+  int             running;          // a dispatcher exists
+} task_queue;
+#define PARK_BITS    8
+#define PARK_BUCKETS (1 << PARK_BITS)
+typedef struct park_bucket { struct park_node *head, *tail; } park_bucket;
+
+extern rr_queue   *rt_rr(void);
+extern lwp_inbox  *rt_inbox(void);
+extern lwp_inbox  *tid_inbox(tid_t tid);     // these two: any OS thread
+extern lwp_inbox  *runtime_inbox(lwp_runtime *rt);  // NULL: the default
+extern sched_hist *rt_hists(void);
+extern park_bucket *rt_park(void);
+extern group_table *rt_groups(void);
+extern task_queue  *rt_tasks(void);
+extern void        task_promote(thread t);
+extern thread      quota_pick(thread t);
+extern void        thread_unthrottle(thread t);
+extern lwp_group   *group_get(unsigned int gid, int create);
+extern void        groups_fini(group_table *gt);
+extern void      inbox_init(lwp_inbox *ib);
+extern void      inbox_fini(lwp_inbox *ib);
+extern void      inbox_drain(lwp_inbox *ib);
+extern void      inbox_idle(lwp_inbox *ib);
+// anything posted and not yet drained? (owning runtime only)
+#define INBOX_PENDING(ib) ((ib)->tail != &(ib)->stub || \
+  __atomic_load_n(&(ib)->head, __ATOMIC_RELAXED) != &(ib)->stub)
+
 #endif
@@ -0,0 +1,84 @@
+#include "lwp.h"
+#include "slab.h"
+#include <stdlib.h>
+
+/* Asymmetric coroutines.
+ *
+ * A coroutine has a context of its own (registers and a stack from the
+ * same places an LWP's come from) but no tid and no run queue entry.
+ * Resume saves the caller's registers in the coroutine record and
+ * swaps to it; yield swaps back.  Each LWP keeps its innermost running
+ * coroutine in its control block, so lwp_coro_yield() knows where to
+ * go and coroutines can resume other coroutines.  If a coroutine calls
+ * lwp_yield() the LWP's saved state simply points into the coroutine's
+ * stack until it is scheduled again.
+ */
+struct lwp_coro {
+  rfile       caller;           // the resumer, while the coroutine runs
+  thread      ctx;              // the coroutine's own registers and stack
+  lwp_corofun fn;
+  void        *xfer;            // value passed by resume / yield
+  lwp_coro    outer;            // coroutine that resumed this one, if any
+  thread      owner;            // LWP running it, NULL while suspended
+  int         done;             // fn has returned
+};
+
+// per OS thread, like the runtimes using it
+static __thread slab_cache coro_slab = SLAB_CACHE(struct lwp_coro, 64);
+
+static int coro_main(void *p){
+  lwp_coro co = (lwp_coro)p;
+  co->xfer = co->fn(co->xfer);
+  co->done = 1;
+  swap_rfiles(co->ctx->state, &co->caller);      // never resumed again
+  abort();
+}
+
+lwp_coro lwp_coro_create(lwp_corofun fn, size_t stacksize){
+  lwp_coro co = (lwp_coro)slab_alloc(&coro_slab);
+  if (!co) return NULL;
+  co->fn  = fn;
+  co->ctx = ctx_new(coro_main, co, stacksize);
+  if (!co->ctx){
+    slab_free(&coro_slab, co);
+    return NULL;
+  }
+  return co;
+}
+
+// NULL if co has finished, is already running, or can't be run here
+void *lwp_coro_resume(lwp_coro co, void *in){
+  if (!co || co->done || co->owner) return NULL;
+  thread me = self_thread();
+  if (!me) return NULL;
+
+  co->xfer  = in;
+  co->owner = me;
+  co->outer = (lwp_coro)me->coro;
+  me->coro  = co;
+  swap_rfiles(&co->caller, co->ctx->state);
+  me->coro  = co->outer;
+  co->owner = NULL;
+  return co->xfer;
+}
+
+// Back to whoever resumed the running coroutine (NULL outside one)
+void *lwp_coro_yield(void *out){
+  thread me = cur_thread();
+  lwp_coro co = me ? (lwp_coro)me->coro : NULL;
+  if (!co) return NULL;
+  co->xfer = out;
+  swap_rfiles(co->ctx->state, &co->caller);
+  return co->xfer;
+}
+
+int lwp_coro_done(lwp_coro co){
+  return !co || co->done;
+}
+
+// A suspended coroutine's frames are simply dropped
+void lwp_coro_destroy(lwp_coro co){
+  if (!co || co->owner) return;
+  ctx_free(co->ctx);
+  slab_free(&coro_slab, co);
+}
@@ -0,0 +1,100 @@
+#include "lwp.h"
+#include "slab.h"
+
+/* Futures.  Each lwp_spawn() gets a pooled record and a detached LWP
+ * that fills it in, so nothing goes through the terminated FIFO and
+ * the thread itself is gone as soon as it returns.  Whoever awaits a
+ * future that isn't done blocks; the LWP that completes it hands the
+ * CPU straight to that waiter as it exits.
+ */
+struct lwp_future {
+  lwp_task fn;
+  void     *arg;
+  void     *result;
+  int      done;
+  thread   waiter;              // blocked in lwp_await*(), or NULL
+};
+
+// per OS thread, like the runtimes using it
+static __thread slab_cache future_slab = SLAB_CACHE(struct lwp_future, 64);
+
+static int future_run(void *p){
+  lwp_future f = (lwp_future)p;
+  f->result = f->fn(f->arg);
+  f->done = 1;
+  if (f->waiter){
+    thread w = f->waiter;
+    f->waiter = NULL;
+    thread_handoff(w);          // runs next, when we exit below
+  }
+  return 0;
+}
+
+lwp_future lwp_spawn(lwp_task fn, void *arg){
+  lwp_future f = (lwp_future)slab_alloc(&future_slab);
+  if (!f) return NULL;
+  f->fn  = fn;
+  f->arg = arg;
+  lwp_attr det = { LWP_ATTR_DETACHED, 0 };
+  if (lwp_create_attr(future_run, f, &det) == NO_THREAD){
+    slab_free(&future_slab, f);
+    return NULL;
+  }
+  return f;
+}
+
+int lwp_future_ready(lwp_future f){
+  return f && f->done;
+}
+
+// Take the result and put the record back in the pool
+static void *take(lwp_future f){
+  void *r = f->result;
+  slab_free(&future_slab, f);
+  return r;
+}
+
+void *lwp_await(lwp_future f){
+  if (!f) return NULL;
+  while (!f->done){
+    f->waiter = self_thread();
+    if (thread_block()){
+      f->waiter = NULL;
+      return NULL;
+    }
+  }
+  return take(f);
+}
+
+void lwp_await_all(lwp_future fs[], size_t n, void *results[]){
+  for (size_t i = 0; i < n; i++){
+    void *r = lwp_await(fs[i]);
+    if (results) results[i] = r;
+    fs[i] = NULL;
+  }
+}
+
+/* Wait for the first of fs[] to finish: its result goes to *result, its
+ * slot is set to NULL and its index returned.  NULL slots are skipped,
+ * so calling again collects the next one.
+ */
+size_t lwp_await_any(lwp_future fs[], size_t n, void **result){
+  thread me = self_thread();
+  for (;;){
+    for (size_t i = 0; i < n; i++){
+      if (fs[i] && fs[i]->done){
+        void *r = take(fs[i]);
+        if (result) *result = r;
+        fs[i] = NULL;
+        return i;
+      }
+    }
+    size_t live = 0;
+    for (size_t i = 0; i < n; i++)
+      if (fs[i]){ fs[i]->waiter = me; live++; }
+    int stuck = !live || thread_block();
+    for (size_t i = 0; i < n; i++)
+      if (fs[i] && fs[i]->waiter == me) fs[i]->waiter = NULL;
+    if (stuck) return n;
+  }
+}
@@ -0,0 +1,324 @@
+#include "lwp.h"
+#include "tsc.h"
+#include <stdlib.h>
+#include <time.h>
+
+/* Locality groups.  A group is only an id stamped on its members; the
+ * record behind it (see lwp.h) lives in the bound runtime's table.
+ */
+static unsigned int hash(unsigned int gid){
+  return (gid * 0x9e3779b9u) >> 26;             // GROUP_BUCKETS == 64
+}
+
+// gid's record, made if create is set; NULL if not there (or no memory)
+lwp_group *group_get(unsigned int gid, int create){
+  group_table *gt = rt_groups();
+  if (!gid) return &gt->none;
+  lwp_group **b = &gt->bucket[hash(gid)];
+  for (lwp_group *g = *b; g; g = g->hnext)
+    if (g->gid == gid) return g;
+  if (!create) return NULL;
+  lwp_group *g = (lwp_group*)calloc(1, sizeof *g);
+  if (!g) return NULL;
+  g->gid   = gid;
+  g->hnext = *b;
+  *b = g;
+  return g;
+}
+
+void groups_fini(group_table *gt){
+  for (int i = 0; i < GROUP_BUCKETS; i++){
+    while (gt->bucket[i]){
+      lwp_group *g = gt->bucket[i];
+      gt->bucket[i] = g->hnext;
+      free(g);
+    }
+  }
+}
+
+/* Group scheduler.  Runnable threads are queued (FIFO, through
+ * sched_one/sched_two) on their group, and groups with any are linked
+ * in a ring.  next() runs the group whose turn it is: as many of its
+ * members as it had queued when the turn began, then the turn passes
+ * on.  A member that yields goes to the back of its group, so it runs
+ * again next turn, not this one.
+ */
+#define gs_next_of(t) ((t)->sched_one)
+#define gs_prev_of(t) ((t)->sched_two)
+
+// Where t is (or would be) queued; records exist before their members
+static lwp_group *group_of(thread t){
+  lwp_group *g = group_get(t->group, 0);
+  return g ? g : &rt_groups()->none;
+}
+
+static void ring_add(group_table *gt, lwp_group *g){
+  if (!gt->turn){
+    g->ring_next = g->ring_prev = g;
+    gt->turn = g;
+    gt->turn_left = 0;
+    return;
+  }
+  g->ring_next = gt->turn;                      // last in the rotation
+  g->ring_prev = gt->turn->ring_prev;
+  g->ring_prev->ring_next = g;
+  gt->turn->ring_prev = g;
+}
+
+static void ring_drop(group_table *gt, lwp_group *g){
+  lwp_group *next = g->ring_next;
+  if (next == g) next = NULL;
+  else {
+    g->ring_prev->ring_next = next;
+    next->ring_prev = g->ring_prev;
+  }
+  g->ring_next = g->ring_prev = NULL;
+  if (gt->turn == g){
+    gt->turn = next;
+    gt->turn_left = 0;
+  }
+}
+
+// 1 if t was queued (and now isn't)
+static int gs_unqueue(thread t){
+  lwp_group *g = group_of(t);
+  if (!g->head) return 0;
+  if (t != g->head && !gs_prev_of(t)) return 0;   // not queued
+
+  if (gs_prev_of(t)) gs_next_of(gs_prev_of(t)) = gs_next_of(t);
+  else               g->head = gs_next_of(t);
+  if (gs_next_of(t)) gs_prev_of(gs_next_of(t)) = gs_prev_of(t);
+  else               g->tail = gs_prev_of(t);
+  gs_next_of(t) = gs_prev_of(t) = NULL;
+
+  rt_groups()->count--;
+  if (!--g->count) ring_drop(rt_groups(), g);
+  return 1;
+}
+
+static void gs_init(void){
+  group_table *gt = rt_groups();
+  gt->turn = NULL;
+  gt->turn_left = 0;
+  gt->count = 0;
+}
+
+static void gs_shutdown(void){
+  group_table *gt = rt_groups();
+  while (gt->turn){
+    lwp_group *g = gt->turn;
+    while (g->head){
+      thread t = g->head;
+      g->head = gs_next_of(t);
+      gs_next_of(t) = gs_prev_of(t) = NULL;
+    }
+    g->tail = NULL;
+    g->count = 0;
+    ring_drop(gt, g);
+  }
+  gt->count = 0;
+}
+
+static void gs_remove(thread t){
+  if (t) gs_unqueue(t);
+}
+
+static void gs_admit(thread t){
+  if (!t) return;
+  gs_unqueue(t);
+
+  group_table *gt = rt_groups();
+  lwp_group *g = group_of(t);
+  gs_next_of(t) = NULL;
+  gs_prev_of(t) = g->tail;
+  if (g->tail) gs_next_of(g->tail) = t;
+  else         g->head = t;
+  g->tail = t;
+  gt->count++;
+  if (g->count++ == 0) ring_add(gt, g);
+}
+
+static thread gs_next(void){
+  group_table *gt = rt_groups();
+  lwp_group *g = gt->turn;
+  if (!g) return NULL;
+  if (!gt->turn_left) gt->turn_left = g->count;
+
+  thread t = g->head;
+  g->head = gs_next_of(t);
+  if (g->head) gs_prev_of(g->head) = NULL;
+  else         g->tail = NULL;
+  gs_next_of(t) = NULL;
+  gt->count--;
+
+  if (!--g->count)          ring_drop(gt, g);
+  else if (!--gt->turn_left) gt->turn = g->ring_next;
+  return t;
+}
+
+static int gs_qlen(void){
+  return rt_groups()->count;
+}
+
+static struct scheduler GS = {
+  .init     = gs_init,
+  .shutdown = gs_shutdown,
+  .admit    = gs_admit,
+  .remove   = gs_remove,
+  .next     = gs_next,
+  .qlen     = gs_qlen
+};
+
+scheduler lwp_group_scheduler(void){ return &GS; }
+
+/* Moving a queued thread to another group means requeueing it there;
+ * no other scheduler looks at groups, so it only matters under ours.
+ */
+int lwp_set_group(tid_t tid, unsigned int gid){
+  thread t = tid2thread(tid);
+  if (!t || LWPTERMINATED(t->status)) return -1;
+  if (!group_get(gid, 1)) return -1;
+  int queued = lwp_get_scheduler() == &GS && gs_unqueue(t);
+  t->group = gid;
+  if (queued) gs_admit(t);
+  return 0;
+}
+
+unsigned lwp_get_group(tid_t tid){
+  thread t = tid2thread(tid);
+  return t ? t->group : 0;
+}
+
+/* Quotas.  quota_pick() runs from sched_next() while any group has a
+ * quota: it charges the LWP that just ran, puts throttled groups whose
+ * period is over back in business, and holds back whatever the
+ * scheduler picked from a group that is still throttled.  Held members
+ * wait on their group (through held_next, in order) until it is
+ * refilled.
+ */
+// Start as many new periods as have gone by, paying off what they cover
+static void roll(lwp_group *g, unsigned long now){
+  if (now < g->period_end) return;
+  unsigned long n = (now - g->period_end) / g->period + 1;
+  g->used = g->used > n * g->budget ? g->used - n * g->budget : 0;
+  g->period_end += n * g->period;
+}
+
+static void throttle(group_table *gt, lwp_group *g, unsigned long now){
+  g->throttled = 1;
+  g->throttles++;
+  g->throttled_at = now;
+  g->throttled_next = gt->throttled;
+  gt->throttled = g;
+}
+
+static void unthrottle(lwp_group *g, unsigned long now){
+  g->throttled = 0;
+  g->throttled_ticks += now - g->throttled_at;
+  while (g->held_head){
+    thread t = g->held_head;
+    g->held_head = t->held_next;
+    t->held_next = NULL;
+    thread_unthrottle(t);
+  }
+  g->held_tail = NULL;
+  g->nheld = 0;
+}
+
+static void charge(group_table *gt, unsigned long now){
+  thread t = cur_thread();
+  unsigned long ran = now - gt->charged_at;
+  gt->charged_at = now;
+  lwp_group *g = t ? group_get(t->group, 0) : NULL;
+  if (!g) return;
+  g->used_total += ran;
+  if (!g->budget) return;
+  roll(g, now);
+  g->used += ran;
+  if (g->used >= g->budget && !g->throttled) throttle(gt, g, now);
+}
+
+// Refill the groups whose budget is back; when the next refill is due
+static unsigned long refill(group_table *gt, unsigned long now){
+  unsigned long next = 0;
+  lwp_group **pp = &gt->throttled;
+  while (*pp){
+    lwp_group *g = *pp;
+    if (g->budget) roll(g, now);
+    if (!g->budget || g->used < g->budget){
+      *pp = g->throttled_next;
+      g->throttled_next = NULL;
+      unthrottle(g, now);
+      continue;
+    }
+    if (!next || g->period_end < next) next = g->period_end;
+    pp = &g->throttled_next;
+  }
+  return next;
+}
+
+static int hold(thread t){
+  lwp_group *g = group_get(t->group, 0);
+  if (!g || !g->throttled) return 0;
+  t->flags |= LWPF_THROTTLED;
+  t->held_next = NULL;
+  if (g->held_tail) g->held_tail->held_next = t;
+  else              g->held_head = t;
+  g->held_tail = t;
+  g->nheld++;
+  return 1;
+}
+
+thread quota_pick(thread t){
+  group_table *gt = rt_groups();
+  scheduler s = lwp_get_scheduler();
+  unsigned long now = tsc_now();
+  charge(gt, now);
+  for (;;){
+    unsigned long due = gt->throttled ? refill(gt, now) : 0;
+    if (!t) t = s->next();
+    while (t && hold(t)) t = s->next();
+    if (t || !gt->throttled) return t;
+
+    // only throttled LWPs left: sleep through to the first refill
+    unsigned long ns = tsc_to_ns(due - now);
+    struct timespec ts = { (time_t)(ns / 1000000000UL), (long)(ns % 1000000000UL) };
+    nanosleep(&ts, NULL);
+    now = gt->charged_at = tsc_now();           // nobody ran meanwhile
+  }
+}
+
+static unsigned long us_to_ticks(unsigned long us){
+  return (unsigned long)((double)us * tsc_hz() / 1e6);
+}
+
+int lwp_group_quota(unsigned int gid, unsigned long budget_us,
+                    unsigned long period_us){
+  if (budget_us && (!period_us || budget_us > period_us)) return -1;
+  lwp_group *g = group_get(gid, 1);
+  if (!g) return -1;
+  group_table *gt = rt_groups();
+  unsigned long now = tsc_now();
+  if (!gt->quotas) gt->charged_at = now;
+  if (!g->budget && budget_us)  gt->quotas++;
+  if (g->budget && !budget_us)  gt->quotas--;
+
+  g->budget     = us_to_ticks(budget_us);
+  g->period     = us_to_ticks(period_us);
+  g->period_end = now + g->period;
+  g->used       = 0;
+  if (g->throttled) refill(gt, now);            // lets g go at once
+  return 0;
+}
+
+int lwp_group_usage(unsigned int gid, lwp_group_stats *out){
+  lwp_group *g = group_get(gid, 0);
+  if (!g || !out) return -1;
+  unsigned long throttled = g->throttled_ticks;
+  if (g->throttled) throttled += tsc_now() - g->throttled_at;
+  out->usage_ns     = tsc_to_ns(g->used_total);
+  out->throttles    = g->throttles;
+  out->throttled_ns = tsc_to_ns(throttled);
+  out->held         = g->nheld;
+  return 0;
+}
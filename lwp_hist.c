@@ -0,0 +1,105 @@
+#include "lwp.h"
+#include "tsc.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Log-bucketed (HDR-style) histograms of run-queue wait.
+ *
+ * Values below 2*SUB land in their own bucket; above that each power
+ * of two is split into SUB linear sub-buckets, so every bucket is
+ * within 1/SUB (12.5%) of the values it holds.  Recording is a clz,
+ * a shift and an increment.
+ */
+#define SUB     (1UL << LWP_HIST_SUBBITS)
+
+static inline unsigned hist_index(unsigned long v){
+  if (v < 2 * SUB) return (unsigned)v;
+  unsigned msb   = 63 - (unsigned)__builtin_clzl(v);
+  unsigned shift = msb - LWP_HIST_SUBBITS;
+  return (msb - LWP_HIST_SUBBITS + 1) * SUB + ((v >> shift) & (SUB - 1));
+}
+
+// Largest value that maps to bucket idx
+static unsigned long hist_upper(unsigned idx){
+  if (idx < 2 * SUB) return idx;
+  unsigned msb = idx / SUB + LWP_HIST_SUBBITS - 1;
+  unsigned long lo = (SUB + idx % SUB) << (msb - LWP_HIST_SUBBITS);
+  return lo + (1UL << (msb - LWP_HIST_SUBBITS)) - 1;
+}
+
+void hist_record(lwp_hist *h, unsigned long ticks){
+  h->bucket[hist_index(ticks)]++;
+  h->count++;
+  if (ticks > h->max) h->max = ticks;
+}
+
+// Quantile in the recorded unit (ticks for wait histograms)
+unsigned long lwp_hist_value(const lwp_hist *h, double q){
+  if (!h || !h->count) return 0;
+  if (q >= 1.0) return h->max;
+
+  unsigned long want = (unsigned long)(q * (double)h->count + 0.5);
+  if (want == 0) want = 1;
+
+  unsigned long seen = 0;
+  for (unsigned i = 0; i < LWP_HIST_BUCKETS; i++){
+    seen += h->bucket[i];
+    if (seen >= want){
+      unsigned long v = hist_upper(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+unsigned long lwp_hist_quantile(const lwp_hist *h, double q){
+  return tsc_to_ns(lwp_hist_value(h, q));
+}
+
+void lwp_hist_print(FILE *out, const char *label, const lwp_hist *h){
+  fprintf(out, "%-12s n=%lu p50=%luns p99=%luns p999=%luns max=%luns\n",
+          label, h->count,
+          lwp_hist_quantile(h, 0.50),
+          lwp_hist_quantile(h, 0.99),
+          lwp_hist_quantile(h, 0.999),
+          lwp_hist_quantile(h, 1.0));
+}
+
+/* One histogram per scheduler that has ever dispatched a thread, in a
+ * table per runtime (see rt_hists()).
+ */
+lwp_hist *hist_for(scheduler s){
+  sched_hist *sh = rt_hists();
+  int i;
+  for (i = 0; i < HIST_SCHEDS && sh[i].s; i++)
+    if (sh[i].s == s) return &sh[i].h;
+  if (i == HIST_SCHEDS) i--;       // table full: share the last slot
+  sh[i].s = s;
+  return &sh[i].h;
+}
+
+int lwp_hist_sched(scheduler s, lwp_hist *out){
+  sched_hist *sh = rt_hists();
+  for (int i = 0; i < HIST_SCHEDS && sh[i].s; i++){
+    if (sh[i].s == s){
+      if (out) memcpy(out, &sh[i].h, sizeof *out);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void hist_reset_scheds(void){
+  sched_hist *sh = rt_hists();
+  for (int i = 0; i < HIST_SCHEDS; i++)
+    memset(&sh[i].h, 0, sizeof sh[i].h);
+}
+
+void lwp_hist_dump(FILE *out){
+  char label[32];
+  sched_hist *sh = rt_hists();
+  for (int i = 0; i < HIST_SCHEDS && sh[i].s; i++){
+    snprintf(label, sizeof label, "sched[%d]", i);
+    lwp_hist_print(out, label, &sh[i].h);
+  }
+}
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include "lwp.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Posting to the LWPs from other OS threads.
+ *
+ * lwp_post_wakeup(), lwp_post_task() and lwp_runtime_post() are the only
+ * calls that may come from outside: they malloc a message and push it
+ * onto an intrusive multi-producer/single-consumer queue (Vyukov's: one
+ * exchange per push, no CAS loop, no locks).  Everything else happens
+ * on the LWP side when the queue is drained: from sched_next(), so at
+ * every dispatch, and from inbox_idle() when there is nothing left to
+ * run.  A fully drained queue has the stub at both ends, so "anything
+ * posted?" is two loads and compares.  (The head alone isn't enough: if
+ * a producer pushes while pop() puts the stub back, the head can be the
+ * stub with messages still ahead of it.)
+ *
+ * The eventfd is only written when the LWP side has said it is about to
+ * sleep on it, so posting to a busy runtime costs no system call.
+ *
+ * Each runtime has an inbox of its own (see lwp.h); a wakeup goes to
+ * the one its tid belongs to.
+ */
+#define INBOX_BATCH 64               // messages handled per drain
+
+void inbox_init(lwp_inbox *ib){
+  ib->head = ib->tail = &ib->stub;
+  ib->stub.next = NULL;
+  ib->fd = -1;
+  ib->sleeping = 0;
+}
+
+// Drop anything still queued, close the eventfd
+void inbox_fini(lwp_inbox *ib){
+  struct inbox_msg *m = ib->tail;
+  while (m){
+    struct inbox_msg *next = m->next;
+    if (m != &ib->stub) free(m);
+    m = next;
+  }
+  if (ib->fd >= 0) close(ib->fd);
+  inbox_init(ib);
+}
+
+// Create the eventfd once, whichever side gets there first
+static int inbox_eventfd(lwp_inbox *ib){
+  int fd = __atomic_load_n(&ib->fd, __ATOMIC_ACQUIRE);
+  if (fd >= 0) return fd;
+  int mine = eventfd(0, EFD_CLOEXEC);
+  if (mine < 0) return -1;
+  int none = -1;
+  if (__atomic_compare_exchange_n(&ib->fd, &none, mine, 0,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return mine;
+  close(mine);
+  return none;
+}
+
+static void push(lwp_inbox *ib, struct inbox_msg *m){
+  __atomic_store_n(&m->next, NULL, __ATOMIC_RELAXED);
+  struct inbox_msg *prev = __atomic_exchange_n(&ib->head, m, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&prev->next, m, __ATOMIC_RELEASE);
+}
+
+// NULL if empty, or if a producer is half way through a push
+static struct inbox_msg *pop(lwp_inbox *ib){
+  struct inbox_msg *tail = ib->tail;
+  struct inbox_msg *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (tail == &ib->stub){
+    if (!next) return NULL;
+    ib->tail = tail = next;
+    next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+  }
+  if (next){
+    ib->tail = next;
+    return tail;
+  }
+  if (tail != __atomic_load_n(&ib->head, __ATOMIC_ACQUIRE)) return NULL;
+  push(ib, &ib->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next){
+    ib->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+// Any thread: push, then kick the eventfd if the LWP side is asleep
+static int post(lwp_inbox *ib, struct inbox_msg *m){
+  push(ib, m);
+  if (__atomic_load_n(&ib->sleeping, __ATOMIC_SEQ_CST)){
+    uint64_t one = 1;
+    int fd = inbox_eventfd(ib);
+    if (fd < 0 || write(fd, &one, sizeof one) != sizeof one) return -1;
+  }
+  return 0;
+}
+
+int lwp_post_wakeup(tid_t tid){
+  lwp_inbox *ib = tid_inbox(tid);
+  if (!ib) return -1;
+  struct inbox_msg *m = (struct inbox_msg*)malloc(sizeof *m);
+  if (!m) return -1;
+  m->tid = tid;
+  m->fn  = NULL;
+  return post(ib, m);
+}
+
+int lwp_runtime_post(lwp_runtime *rt, lwpfun fn, void *arg){
+  lwp_inbox *ib = runtime_inbox(rt);
+  if (!fn || !ib) return -1;
+  struct inbox_msg *m = (struct inbox_msg*)malloc(sizeof *m);
+  if (!m) return -1;
+  m->fn  = fn;
+  m->arg = arg;
+  return post(ib, m);
+}
+
+int lwp_post_task(lwpfun fn, void *arg){
+  return lwp_runtime_post(NULL, fn, arg);
+}
+
+static void deliver(struct inbox_msg *m){
+  if (m->fn){
+    lwp_attr det = { LWP_ATTR_DETACHED, 0 };
+    lwp_create_attr(m->fn, m->arg, &det);
+    return;
+  }
+  thread t = tid2thread(m->tid);
+  if (!t || LWPTERMINATED(t->status)) return;
+  t->flags |= LWPF_POSTED;
+  if (t->flags & LWPF_SUSPENDED) thread_wake(t);
+}
+
+// LWP side: handle up to a batch of messages
+void inbox_drain(lwp_inbox *ib){
+  struct inbox_msg *m;
+  for (int n = 0; n < INBOX_BATCH && (m = pop(ib)); n++){
+    deliver(m);
+    free(m);
+  }
+}
+
+/* Idle policy.  The LWP side goes idle when nothing is runnable but
+ * live LWPs are blocked: only a post can change that, so it polls the
+ * queue for up to idle_spins rounds (LWP_IDLE_SPIN: then gives up and
+ * lets the caller look again) and then sleeps on the eventfd.
+ */
+static int idle_policy = LWP_IDLE_SPIN_PARK;
+static unsigned long idle_spins = 1000;
+
+void lwp_set_idle(int policy, unsigned long spins){
+  idle_policy = policy;
+  idle_spins  = policy == LWP_IDLE_PARK ? 0 : spins;
+}
+
+static void park(lwp_inbox *ib){
+  int fd = inbox_eventfd(ib);
+  if (fd < 0) return;
+  /* The flag is raised before the last look at the queue, and producers
+   * push before looking at the flag, so one of the two sees the other.
+   */
+  __atomic_store_n(&ib->sleeping, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!INBOX_PENDING(ib)){
+    uint64_t v;
+    if (read(fd, &v, sizeof v) < 0) { /* EINTR: just look again */ }
+  }
+  __atomic_store_n(&ib->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+// LWP side, nothing runnable: wait (per the policy) for a post
+void inbox_idle(lwp_inbox *ib){
+  for (unsigned long i = 0; i < idle_spins && !INBOX_PENDING(ib); i++)
+    __builtin_ia32_pause();
+  if (!INBOX_PENDING(ib) && idle_policy != LWP_IDLE_SPIN) park(ib);
+  inbox_drain(ib);
+}
+
+int lwp_suspend(void){
+  thread me = self_thread();
+  if (!me) return -1;
+  lwp_inbox *ib = rt_inbox();
+  for (;;){
+    if (INBOX_PENDING(ib)) inbox_drain(ib);
+    if (me->flags & LWPF_POSTED){
+      me->flags &= ~LWPF_POSTED;
+      return 0;
+    }
+    me->flags |= LWPF_SUSPENDED;
+    int stuck = thread_block();
+    me->flags &= ~LWPF_SUSPENDED;
+    if (stuck) inbox_idle(ib);         // nothing else can run
+  }
+}
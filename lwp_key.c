@@ -0,0 +1,96 @@
+#include "lwp.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* LWP-local storage.  A key is an index: below LWP_KEYS_INLINE it
+ * picks a slot in the control block, above that a slot in the
+ * thread's keys_more array, which grows (doubling) when a key past its
+ * end is first set.  A get is a bounds check and a load.  Keys are
+ * never deleted, so an index is never reused for something else.
+ */
+static void (*dtors[LWP_KEYS_MAX])(void *);
+static lwp_key_t nkeys = 0;
+
+// Keys are process-wide, so runtimes on other pthreads may race here
+int lwp_key_create(lwp_key_t *key, void (*dtor)(void *)){
+  if (!key) return -1;
+  lwp_key_t k = __atomic_load_n(&nkeys, __ATOMIC_RELAXED);
+  do {
+    if (k == LWP_KEYS_MAX) return -1;
+  } while (!__atomic_compare_exchange_n(&nkeys, &k, k + 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  dtors[k] = dtor;
+  *key = k;
+  return 0;
+}
+
+void *lwp_getspecific(lwp_key_t key){
+  thread t = cur_thread();
+  if (!t) return NULL;
+  if (key < LWP_KEYS_INLINE) return t->keys[key];
+  key -= LWP_KEYS_INLINE;
+  return key < t->keys_cap ? t->keys_more[key] : NULL;
+}
+
+// Make room for keys_more[i]
+static int keys_grow(thread t, unsigned int i){
+  unsigned int cap = t->keys_cap ? t->keys_cap : 4;
+  while (cap <= i) cap *= 2;
+  void **more = (void**)realloc(t->keys_more, cap * sizeof *more);
+  if (!more) return -1;
+  memset(more + t->keys_cap, 0, (cap - t->keys_cap) * sizeof *more);
+  t->keys_more = more;
+  t->keys_cap  = cap;
+  return 0;
+}
+
+int lwp_setspecific(lwp_key_t key, const void *value){
+  if (key >= nkeys) return -1;
+  thread t = self_thread();
+  if (!t) return -1;
+  t->flags |= LWPF_KEYS;
+  if (key < LWP_KEYS_INLINE){
+    t->keys[key] = (void*)value;
+    return 0;
+  }
+  key -= LWP_KEYS_INLINE;
+  if (key >= t->keys_cap && keys_grow(t, key)) return -1;
+  t->keys_more[key] = (void*)value;
+  return 0;
+}
+
+// Clear key's slot in t, returning what was there
+static void *take(thread t, lwp_key_t key){
+  void **slot = key < LWP_KEYS_INLINE ? &t->keys[key]
+              : key - LWP_KEYS_INLINE < t->keys_cap
+              ? &t->keys_more[key - LWP_KEYS_INLINE] : NULL;
+  void *v = slot ? *slot : NULL;
+  if (v) *slot = NULL;
+  return v;
+}
+
+/* Run t's destructors and empty its slots, as if it were exiting, but
+ * keep the array; lwp_submit()'s dispatcher calls this between tasks.
+ */
+void keys_clear(thread t){
+  for (int round = 0; round < LWP_KEYS_DTOR_ROUNDS; round++){
+    int ran = 0;
+    for (lwp_key_t k = 0; k < nkeys; k++){
+      if (!dtors[k]) continue;
+      void *v = take(t, k);
+      if (v){ dtors[k](v); ran = 1; }
+    }
+    if (!ran) break;
+  }
+  if (t->keys_cap) memset(t->keys_more, 0, t->keys_cap * sizeof *t->keys_more);
+  memset(t->keys, 0, sizeof t->keys);
+  t->flags &= ~LWPF_KEYS;
+}
+
+// Called by lwp_exit() while t still runs: destructors, then the array
+void keys_exit(thread t){
+  keys_clear(t);
+  free(t->keys_more);
+  t->keys_more = NULL;
+  t->keys_cap  = 0;
+}
@@ -0,0 +1,79 @@
+#include "lwp.h"
+#include "slab.h"
+#include <stdint.h>
+
+/* Parking lot.  A parked LWP puts a node into the bucket its address
+ * hashes to and blocks; unparking walks that bucket for nodes with the
+ * same address.  Buckets are FIFO, so waiters on one address are woken
+ * in the order they parked.  Collisions only cost a longer walk.  The
+ * nodes come from a slab, not the parker's stack: shared-stack LWPs all
+ * park at the same stack addresses.
+ */
+struct park_node {
+  const void       *addr;
+  thread           t;
+  struct park_node *next, *prev;
+  int              woken;
+};
+
+// per OS thread, like the runtimes using it
+static __thread slab_cache node_slab __attribute__((tls_model("initial-exec")))
+    = SLAB_CACHE(struct park_node, 64);
+
+static park_bucket *bucket_of(const void *addr){
+  uint64_t h = ((uintptr_t)addr >> 2) * 0x9e3779b97f4a7c15UL;
+  return &rt_park()[h >> (64 - PARK_BITS)];
+}
+
+static void unlink_node(park_bucket *b, struct park_node *n){
+  if (n->prev) n->prev->next = n->next;
+  else         b->head = n->next;
+  if (n->next) n->next->prev = n->prev;
+  else         b->tail = n->prev;
+}
+
+int lwp_park(const int *addr, int expected){
+  if (*(const volatile int*)addr != expected) return 1;
+  thread me = self_thread();
+  if (!me) return -1;
+
+  struct park_node *n = (struct park_node*)slab_alloc(&node_slab);
+  if (!n) return -1;
+  park_bucket *b = bucket_of(addr);
+  n->addr = addr;
+  n->t    = me;
+  n->prev = b->tail;
+  if (b->tail) b->tail->next = n;
+  else         b->head = n;
+  b->tail = n;
+
+  int stuck = thread_block();
+  if (!n->woken) unlink_node(b, n);   // spurious, or nobody to wake us
+  slab_free(&node_slab, n);
+  return stuck ? -1 : 0;
+}
+
+static size_t unpark(const void *addr, size_t max){
+  park_bucket *b = bucket_of(addr);
+  size_t woke = 0;
+  struct park_node *n = b->head;
+  while (n && woke < max){
+    struct park_node *next = n->next;
+    if (n->addr == addr){
+      unlink_node(b, n);
+      n->woken = 1;
+      thread_wake(n->t);
+      woke++;
+    }
+    n = next;
+  }
+  return woke;
+}
+
+size_t lwp_unpark_one(const void *addr){
+  return unpark(addr, 1);
+}
+
+size_t lwp_unpark_all(const void *addr){
+  return unpark(addr, (size_t)-1);
+}
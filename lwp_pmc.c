@@ -0,0 +1,170 @@
+#include "lwp.h"
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Per-LWP hardware counters.
+ *
+ * The kernel only sees one thread, so we open one counter group for it
+ * and snapshot the group at every context switch; the difference since
+ * the previous switch belongs to the thread being switched out.  When
+ * the PMU lets user space read counters directly (cap_user_rdpmc) a
+ * snapshot is a few rdpmc instructions; otherwise it is one read() of
+ * the whole group.  Without a PMU (most VMs) we count software events
+ * instead, which still tells you who is eating CPU and faulting.
+ */
+typedef struct evdesc { unsigned type; unsigned long config; const char *name; } evdesc;
+
+static const evdesc hw_set[LWP_PMC_MAX] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     "cache-misses" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    "branch-misses" },
+};
+
+static const evdesc sw_set[LWP_PMC_MAX] = {
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,       "task-clock-ns" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      "page-faults" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "os-switches" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS,   "cpu-migrations" },
+};
+
+int lwp_pmc_on = 0;
+
+static const evdesc *cur_set = NULL;
+static int fds[LWP_PMC_MAX] = { -1, -1, -1, -1 };
+static struct perf_event_mmap_page *pages[LWP_PMC_MAX];
+static unsigned long last[LWP_PMC_MAX];
+static long pagesz = 0;
+
+static void close_all(void){
+  for (int i = 0; i < LWP_PMC_MAX; i++){
+    if (pages[i]) munmap(pages[i], pagesz);
+    if (fds[i] >= 0) close(fds[i]);
+    pages[i] = NULL;
+    fds[i] = -1;
+  }
+}
+
+static int open_set(const evdesc *set){
+  pagesz = sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < LWP_PMC_MAX; i++){
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof a);
+    a.size           = sizeof a;
+    a.type           = set[i].type;
+    a.config         = set[i].config;
+    a.exclude_kernel = set[i].type == PERF_TYPE_HARDWARE;  // needed for rdpmc
+    a.exclude_hv     = 1;
+    a.read_format    = PERF_FORMAT_GROUP;
+
+    int fd = (int)syscall(SYS_perf_event_open, &a, 0, -1,
+                          i ? fds[0] : -1, 0);
+    if (fd < 0){
+      close_all();
+      return -1;
+    }
+    fds[i] = fd;
+
+    void *p = mmap(NULL, pagesz, PROT_READ, MAP_SHARED, fd, 0);
+    pages[i] = p == MAP_FAILED ? NULL : (struct perf_event_mmap_page*)p;
+  }
+  return 0;
+}
+
+static inline unsigned long rdpmc(unsigned idx){
+  unsigned lo, hi;
+  __asm__ __volatile__ ("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx));
+  return ((unsigned long)hi << 32) | lo;
+}
+
+// Read counter i in user space; 0 if the kernel says we can't
+static int read_direct(int i, unsigned long *out){
+  struct perf_event_mmap_page *pc = pages[i];
+  unsigned seq, idx;
+  long count;
+  if (!pc) return 0;
+  do {
+    seq = pc->lock;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    idx = pc->index;
+    if (!pc->cap_user_rdpmc || !idx) return 0;
+    count = (long)pc->offset;
+    long v = (long)rdpmc(idx - 1);
+    unsigned shift = 64 - pc->pmc_width;
+    count += (v << shift) >> shift;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  } while (pc->lock != seq);
+  *out = (unsigned long)count;
+  return 1;
+}
+
+// Read every counter; 0 (and out only partly filled) if we couldn't
+static int read_all(unsigned long *out){
+  int i;
+  for (i = 0; i < LWP_PMC_MAX; i++)
+    if (!read_direct(i, &out[i])) break;
+  if (i == LWP_PMC_MAX) return 1;
+
+  unsigned long buf[1 + LWP_PMC_MAX];
+  if (read(fds[0], buf, sizeof buf) != (ssize_t)sizeof buf) return 0;
+  memcpy(out, &buf[1], LWP_PMC_MAX * sizeof *out);
+  return 1;
+}
+
+/* Charge everything since the last snapshot to t.  A failed read
+ * charges nothing and keeps the old snapshot, so the next good one
+ * charges the lot.
+ */
+void pmc_switch(thread t){
+  unsigned long now[LWP_PMC_MAX];
+  if (!read_all(now)) return;
+  for (int i = 0; i < LWP_PMC_MAX; i++){
+    t->pmc[i] += now[i] - last[i];
+    last[i] = now[i];
+  }
+}
+
+// Open counters: hardware if possible, software otherwise
+int lwp_pmc_enable(void){
+  if (lwp_pmc_on) return cur_set == hw_set ? LWP_PMC_HW : LWP_PMC_SW;
+
+  int mode = LWP_PMC_HW;
+  cur_set = hw_set;
+  if (open_set(hw_set)){
+    mode = LWP_PMC_SW;
+    cur_set = sw_set;
+    if (open_set(sw_set)){
+      cur_set = NULL;
+      return -1;
+    }
+  }
+  if (!read_all(last)) memset(last, 0, sizeof last);
+  lwp_pmc_on = 1;
+  return mode;
+}
+
+void lwp_pmc_disable(void){
+  if (!lwp_pmc_on) return;
+  thread me = cur_thread();
+  if (me) pmc_switch(me);
+  lwp_pmc_on = 0;
+  close_all();
+}
+
+const char *lwp_pmc_name(int i){
+  if (!cur_set || i < 0 || i >= LWP_PMC_MAX) return NULL;
+  return cur_set[i].name;
+}
+
+// Counters charged to tid so far, including the running slice
+int lwp_pmc_read(tid_t tid, lwp_pmc *out){
+  thread t = tid2thread(tid);
+  if (!t) return -1;
+  thread me = cur_thread();
+  if (lwp_pmc_on && me) pmc_switch(me);
+  if (out) memcpy(out->v, t->pmc, sizeof out->v);
+  return 0;
+}
@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include "lwp.h"
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+/* SIGPROF sampling profiler.
+ *
+ * perf sees one kernel thread; we know which LWP is on the CPU and
+ * where its stack is, so we can do better.  The handler records the
+ * running tid and walks the frame-pointer chain, but only while the
+ * frame stays inside that LWP's own stack, so a bogus rbp can never
+ * send us off reading unmapped memory.  Code built without frame
+ * pointers just gets shallower stacks, and a frameless leaf hides its
+ * immediate caller, exactly as with perf's fp unwinding.
+ *
+ * Everything the handler touches is preallocated; it never calls
+ * into libc.  A sample that lands inside ctx_switch() may be charged
+ * to the thread being switched to, which is noise we accept.
+ */
+typedef struct sample {
+  tid_t         tid;
+  unsigned long depth;
+  unsigned long pc[LWP_PROF_DEPTH];
+} sample;
+
+static sample *samples = NULL;
+static size_t  nsamples_max = 0;
+static volatile size_t nsamples = 0;
+static volatile unsigned long dropped = 0;
+static volatile sig_atomic_t running = 0;
+static struct sigaction old_action;
+
+// Stack bounds for the original thread, which has no LWP stack
+static uintptr_t main_lo = 0, main_hi = 0;
+
+static void find_main_stack(void){
+  FILE *f = fopen("/proc/self/maps", "r");
+  char line[256];
+  if (!f) return;
+  while (fgets(line, sizeof line, f)){
+    if (strstr(line, "[stack]")){
+      unsigned long lo, hi;
+      if (sscanf(line, "%lx-%lx", &lo, &hi) == 2){ main_lo = lo; main_hi = hi; }
+      break;
+    }
+  }
+  fclose(f);
+}
+
+static void on_sigprof(int sig, siginfo_t *si, void *vuc){
+  (void)sig; (void)si;
+  if (!running) return;
+
+  size_t i = nsamples;
+  if (i >= nsamples_max){ dropped++; return; }
+
+  ucontext_t *uc = (ucontext_t*)vuc;
+  uintptr_t pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+  uintptr_t fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+  uintptr_t sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+
+  thread t = cur_thread();
+  uintptr_t lo = main_lo, hi = main_hi;
+  if (t && t->stack){
+    lo = (uintptr_t)t->stack;
+    hi = lo + t->stacksize;
+  }
+  if (sp > lo && sp < hi) lo = sp;       // frames only live above rsp
+
+  sample *s = &samples[i];
+  s->tid = t ? t->tid : NO_THREAD;
+  s->pc[0] = pc;
+  unsigned long d = 1;
+  while (d < LWP_PROF_DEPTH && fp >= lo && fp + 16 <= hi && !(fp & 7)){
+    uintptr_t ret  = ((uintptr_t*)fp)[1];
+    uintptr_t next = ((uintptr_t*)fp)[0];
+    if (!ret) break;
+    s->pc[d++] = ret;
+    if (next <= fp) break;               // stacks grow down; must move up
+    fp = next;
+  }
+  s->depth = d;
+  nsamples = i + 1;
+}
+
+// Start sampling at hz, keeping at most max_samples
+int lwp_prof_start(int hz, size_t max_samples){
+  if (running || hz <= 0 || !max_samples) return -1;
+
+  sample *buf = (sample*)calloc(max_samples, sizeof(*buf));
+  if (!buf) return -1;
+  free(samples);
+  samples = buf;
+  nsamples_max = max_samples;
+  nsamples = 0;
+  dropped = 0;
+  if (!main_hi) find_main_stack();
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_sigaction = on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, &old_action)) return -1;
+
+  struct itimerval it;
+  long usec = 1000000L / hz;
+  if (usec < 1) usec = 1;
+  it.it_interval.tv_sec  = usec / 1000000L;
+  it.it_interval.tv_usec = usec % 1000000L;
+  it.it_value = it.it_interval;
+  running = 1;
+  if (setitimer(ITIMER_PROF, &it, NULL)){
+    running = 0;
+    sigaction(SIGPROF, &old_action, NULL);
+    return -1;
+  }
+  return 0;
+}
+
+void lwp_prof_stop(void){
+  if (!running) return;
+  struct itimerval it;
+  memset(&it, 0, sizeof it);
+  setitimer(ITIMER_PROF, &it, NULL);
+  running = 0;
+  sigaction(SIGPROF, &old_action, NULL);
+}
+
+// Samples taken (and dropped for lack of space) since the last start
+size_t lwp_prof_count(tid_t tid){
+  size_t n = 0;
+  for (size_t i = 0; i < nsamples; i++)
+    if (tid == NO_THREAD || samples[i].tid == tid) n++;
+  return n;
+}
+
+// Order samples by tid, then by stack outermost-first
+static int cmp_sample(const void *a, const void *b){
+  const sample *x = a, *y = b;
+  if (x->tid != y->tid) return x->tid < y->tid ? -1 : 1;
+  unsigned long i = x->depth, j = y->depth;
+  while (i && j){
+    i--; j--;
+    if (x->pc[i] != y->pc[j]) return x->pc[i] < y->pc[j] ? -1 : 1;
+  }
+  return i == j ? 0 : (i < j ? -1 : 1);
+}
+
+// Fold each pc to the start of its function so samples from anywhere
+// in the same function aggregate.  Return addresses point after the
+// call, so callers are looked up at pc-1.
+static void fold_to_symbols(size_t n){
+  Dl_info di;
+  for (size_t i = 0; i < n; i++){
+    sample *s = &samples[i];
+    for (unsigned long d = 0; d < s->depth; d++){
+      uintptr_t at = d ? s->pc[d] - 1 : s->pc[d];
+      if (dladdr((void*)at, &di) && di.dli_sname && di.dli_saddr)
+        s->pc[d] = (uintptr_t)di.dli_saddr;
+    }
+  }
+}
+
+static void put_frame(FILE *out, uintptr_t pc){
+  Dl_info di;
+  if (!dladdr((void*)pc, &di)){
+    fprintf(out, "0x%lx", (unsigned long)pc);
+  } else if (di.dli_sname && di.dli_saddr == (void*)pc){
+    fputs(di.dli_sname, out);
+  } else if (di.dli_fname && di.dli_fbase){
+    const char *base = strrchr(di.dli_fname, '/');
+    fprintf(out, "%s+0x%lx", base ? base + 1 : di.dli_fname,
+            (unsigned long)(pc - (uintptr_t)di.dli_fbase));
+  } else {
+    fprintf(out, "0x%lx", (unsigned long)pc);
+  }
+}
+
+// Emit "lwp-<tid>;outer;...;leaf count" lines for flamegraph.pl
+void lwp_prof_dump(FILE *out){
+  size_t n = nsamples;
+  if (!n) return;
+  fold_to_symbols(n);
+  qsort(samples, n, sizeof *samples, cmp_sample);
+
+  for (size_t i = 0; i < n; ){
+    size_t j = i + 1;
+    while (j < n && !cmp_sample(&samples[i], &samples[j])) j++;
+
+    const sample *s = &samples[i];
+    fprintf(out, "lwp-%lu", (unsigned long)s->tid);
+    for (unsigned long d = s->depth; d > 0; d--){
+      fputc(';', out);
+      put_frame(out, s->pc[d - 1]);
+    }
+    fprintf(out, " %zu\n", j - i);
+    i = j;
+  }
+  if (dropped)
+    fprintf(stderr, "lwp_prof: %lu samples dropped (buffer full)\n", dropped);
+}
@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include "lwp.h"
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Stack overflow reporting and high-water profiling.
+ *
+ * Overflowing an LWP stack runs into the PROT_NONE guard page below
+ * it.  The SIGSEGV handler can't run on the stack that just overflowed,
+ * so it runs on an alternate signal stack (one per OS thread that runs
+ * LWPs, since each runtime's LWPs fault on their own pthread), names
+ * the thread, then
+ * puts back whatever disposition was there before and returns: the
+ * faulting instruction runs again and the process gets that (usually a
+ * core dump).  Faults anywhere else go straight to the old disposition.
+ *
+ * The watermark is the usual paint-and-scan: fill a new stack with a
+ * known word, and at exit the lowest word that no longer holds it is
+ * the deepest the thread ever got.
+ */
+#define PAINT 0x57a7c4ba5e5a1e5fUL
+
+int lwp_stack_paint = 0;
+
+static struct sigaction old_segv;
+static int guard_installed = 0;
+static __thread int altstack_set __attribute__((tls_model("initial-exec")));
+
+// Async-signal-safe number formatting for the report
+static char *put_str(char *p, const char *s){
+  while (*s) *p++ = *s++;
+  return p;
+}
+
+static char *put_num(char *p, unsigned long v, unsigned base){
+  char tmp[24];
+  int n = 0;
+  do { tmp[n++] = "0123456789abcdef"[v % base]; v /= base; } while (v);
+  if (base == 16) p = put_str(p, "0x");
+  while (n) *p++ = tmp[--n];
+  return p;
+}
+
+static void on_sigsegv(int sig, siginfo_t *si, void *vuc){
+  (void)sig; (void)vuc;
+  thread t = cur_thread();
+  uintptr_t a = (uintptr_t)si->si_addr;
+
+  if (t && t->stack && t->guardsize &&
+      a >= (uintptr_t)t->stack - t->guardsize && a < (uintptr_t)t->stack){
+    char msg[192], *p = msg;
+    p = put_str(p, "lwp: stack overflow in thread ");
+    p = put_num(p, t->tid, 10);
+    p = put_str(p, " (entry ");
+    p = put_num(p, (unsigned long)t->entry, 16);
+    p = put_str(p, ", stack ");
+    p = put_num(p, t->stacksize, 10);
+    p = put_str(p, " bytes, fault at ");
+    p = put_num(p, a, 16);
+    p = put_str(p, ")\n");
+    if (write(STDERR_FILENO, msg, (size_t)(p - msg)) < 0) { /* nothing to do */ }
+  }
+  sigaction(SIGSEGV, &old_segv, NULL);     // refault under the old action
+}
+
+/* Install the calling OS thread's alternate stack (once per thread; it
+ * is left behind if the thread exits) and the handler (once).
+ */
+void stack_guard_init(void){
+  if (altstack_set) return;
+  altstack_set = 1;
+
+  size_t size = 64 * 1024;
+  void *alt = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (alt == MAP_FAILED) return;
+  stack_t ss = { .ss_sp = alt, .ss_flags = 0, .ss_size = size };
+  if (sigaltstack(&ss, NULL)){
+    munmap(alt, size);
+    return;
+  }
+
+  int no = 0;
+  if (!__atomic_compare_exchange_n(&guard_installed, &no, 1, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_sigaction = on_sigsegv;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, &old_segv);
+}
+
+void lwp_stack_watermark(int on){
+  lwp_stack_paint = on;
+}
+
+// Fill a stack that nothing is running on yet
+void stack_paint(thread t){
+  if (!t->stack || (t->flags & LWPF_SHARED)) return;
+  unsigned long *p = t->stack, *end = p + t->stacksize / sizeof *p;
+  while (p < end) *p++ = PAINT;
+  t->flags |= LWPF_PAINTED;
+}
+
+// Bytes from the top of t's stack down to the deepest overwritten word
+static size_t stack_depth(thread t){
+  const unsigned long *p = t->stack, *end = p + t->stacksize / sizeof *p;
+  while (p < end && *p == PAINT) p++;
+  return (size_t)((const char*)end - (const char*)p);
+}
+
+// Depth histograms, one per entry function (table full: last slot shared)
+#define STACK_ENTRIES 32
+static struct { lwpfun f; lwp_hist h; } entries[STACK_ENTRIES];
+
+static lwp_hist *hist_of(lwpfun f){
+  int i;
+  for (i = 0; i < STACK_ENTRIES && entries[i].f; i++)
+    if (entries[i].f == f) return &entries[i].h;
+  if (i == STACK_ENTRIES) i--;
+  entries[i].f = f;
+  return &entries[i].h;
+}
+
+// Called by lwp_exit() on the exiting thread's own stack
+void stack_exit(thread t){
+  if (!(t->flags & LWPF_PAINTED)) return;
+  t->stack_hw = stack_depth(t);
+  hist_record(hist_of(t->entry), t->stack_hw);
+}
+
+long lwp_stack_used(tid_t tid){
+  thread t = tid2thread(tid);
+  if (!t || !(t->flags & LWPF_PAINTED)) return -1;
+  if (LWPTERMINATED(t->status)) return (long)t->stack_hw;
+  return (long)stack_depth(t);
+}
+
+int lwp_stack_hist(lwpfun entry, lwp_hist *out){
+  for (int i = 0; i < STACK_ENTRIES && entries[i].f; i++){
+    if (entries[i].f == entry){
+      if (out) memcpy(out, &entries[i].h, sizeof *out);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void lwp_stack_dump(FILE *out){
+  for (int i = 0; i < STACK_ENTRIES && entries[i].f; i++){
+    const lwp_hist *h = &entries[i].h;
+    Dl_info di;
+    const char *name = NULL;
+    if (dladdr((void*)entries[i].f, &di) && di.dli_sname) name = di.dli_sname;
+    if (name) fprintf(out, "%-24s", name);
+    else      fprintf(out, "%#-24lx", (unsigned long)entries[i].f);
+    fprintf(out, " n=%lu p50=%luB p99=%luB max=%luB\n", h->count,
+            lwp_hist_value(h, 0.50), lwp_hist_value(h, 0.99), h->max);
+  }
+}
@@ -0,0 +1,147 @@
+#include "lwp.h"
+#include "tsc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Shared-memory stats segment.
+ *
+ * The segment lives in /dev/shm so that lwptop (or anything else) can
+ * map it read-only while the process keeps running.  The writer never
+ * makes a syscall after lwp_stats_publish(): updates are plain stores
+ * bracketed by a seqlock, and readers retry if seq was odd or changed
+ * under them.
+ */
+lwp_stats_seg *lwp_stats = NULL;
+
+static char seg_name[64];
+static unsigned long run_start = 0;   // when the running LWP went on CPU
+static unsigned long refresh_at = 0;  // next time to sample qlen
+static unsigned long refresh_ticks = 0;
+
+// Free slot stack; slots are handed out lowest-first on a fresh segment
+static unsigned int free_slots[LWP_STATS_SLOTS];
+static unsigned int nfree = 0;
+
+static inline void seq_begin(void){
+  __atomic_store_n(&lwp_stats->seq, lwp_stats->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_end(void){
+  __atomic_store_n(&lwp_stats->seq, lwp_stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+int stats_open(const char *name){
+  if (lwp_stats) return 0;
+
+  if (name) snprintf(seg_name, sizeof seg_name, "%s", name);
+  else      snprintf(seg_name, sizeof seg_name, "/lwp-%ld", (long)getpid());
+
+  int fd = shm_open(seg_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) return -1;
+  if (ftruncate(fd, sizeof(lwp_stats_seg))){
+    close(fd);
+    shm_unlink(seg_name);
+    return -1;
+  }
+  void *m = mmap(NULL, sizeof(lwp_stats_seg), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED){
+    shm_unlink(seg_name);
+    return -1;
+  }
+
+  lwp_stats = (lwp_stats_seg*)m;
+  lwp_stats->version = LWP_STATS_VERSION;
+  lwp_stats->pid     = (unsigned long)getpid();
+  lwp_stats->tsc_hz  = tsc_hz();
+  refresh_ticks      = (unsigned long)(lwp_stats->tsc_hz / 1000.0);
+
+  nfree = 0;
+  for (unsigned i = LWP_STATS_SLOTS; i > 0; i--) free_slots[nfree++] = i - 1;
+
+  run_start = tsc_now();
+  __atomic_store_n(&lwp_stats->magic, LWP_STATS_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void lwp_stats_unpublish(void){
+  if (!lwp_stats) return;
+  lwp_stats_seg *s = lwp_stats;
+  lwp_stats = NULL;
+  munmap(s, sizeof *s);
+  shm_unlink(seg_name);
+}
+
+/* Give t a slot.  Only a live LWP counts as a create: main and threads
+ * that exited before lwp_stats_publish() get slots but never an exit,
+ * so counting them would throw creates - exits ("live") off.
+ */
+void stats_attach(thread t, int counted){
+  seq_begin();
+  if (counted) lwp_stats->creates++;
+  if (nfree){
+    unsigned i = free_slots[--nfree];
+    lwp_stats_thr *s = &lwp_stats->thr[i];
+    s->tid      = t->tid;
+    s->state    = LWPTERMINATED(t->status) ? LWP_ST_EXITED : LWP_ST_READY;
+    s->switches = 0;
+    s->run_tsc  = 0;
+    if (i + 1 > lwp_stats->nslots) lwp_stats->nslots = i + 1;
+    t->stat_slot = i + 1;
+  } else {
+    lwp_stats->overflow++;
+  }
+  seq_end();
+}
+
+void stats_detach(thread t){
+  seq_begin();
+  lwp_stats->reaps++;
+  if (t->stat_slot){
+    unsigned i = t->stat_slot - 1;
+    lwp_stats->thr[i].state = LWP_ST_FREE;
+    lwp_stats->thr[i].tid   = NO_THREAD;
+    free_slots[nfree++] = i;
+    t->stat_slot = 0;
+  }
+  seq_end();
+}
+
+void stats_exit(thread t){
+  seq_begin();
+  lwp_stats->exits++;
+  if (t->stat_slot) lwp_stats->thr[t->stat_slot - 1].state = LWP_ST_EXITED;
+  seq_end();
+}
+
+void stats_switch(thread old, thread next){
+  unsigned long now = tsc_now();
+
+  seq_begin();
+  lwp_stats->switches++;
+  lwp_stats->tsc = now;
+  if (old->stat_slot){
+    lwp_stats_thr *o = &lwp_stats->thr[old->stat_slot - 1];
+    o->run_tsc += now - run_start;
+    if (o->state == LWP_ST_RUNNING) o->state = LWP_ST_READY;
+  }
+  if (next->stat_slot){
+    lwp_stats_thr *n = &lwp_stats->thr[next->stat_slot - 1];
+    n->state = LWP_ST_RUNNING;
+    n->switches++;
+  }
+  run_start = now;
+
+  // qlen() may walk the whole queue, so sample it rather than track it
+  if (now >= refresh_at){
+    scheduler s = lwp_get_scheduler();
+    lwp_stats->qlen = (s && s->qlen) ? (unsigned long)s->qlen() : 0;
+    refresh_at = now + refresh_ticks;
+  }
+  seq_end();
+}
@@ -0,0 +1,87 @@
+#include "lwp.h"
+#include "slab.h"
+
+/* Run-to-completion tasks.  lwp_submit() only queues a record; a
+ * detached dispatcher LWP, made when the queue goes from idle to busy,
+ * pops records and calls them, so a task costs a slab record and an
+ * indirect call.  The dispatcher marks itself LWPF_TASK around each
+ * call; if the task gets to lwp_yield(), thread_block() or lwp_exit()
+ * with that set, it is promoted (task_promote()) and simply keeps the
+ * dispatcher: a promoted dispatcher exits once its task returns, after
+ * a fresh one has been started for the rest of the queue.  The
+ * dispatcher exits too when the queue runs dry, so an idle runtime has
+ * no extra LWP for lwp_wait() to wait on.  Keys a task set are cleared
+ * (destructors and all) before the next one runs.
+ */
+#define TASK_BATCH 256              // tasks run between yields
+
+struct task_rec {
+  struct task_rec *next;
+  lwpfun          fn;
+  void            *arg;
+};
+
+// per OS thread, like the runtimes using it; initial-exec, as rt is
+static __thread slab_cache task_slab __attribute__((tls_model("initial-exec")))
+    = SLAB_CACHE(struct task_rec, 32);
+
+static int dispatch(void *unused);
+
+static int start_dispatcher(task_queue *q){
+  lwp_attr det = { LWP_ATTR_DETACHED, 0 };
+  if (lwp_create_attr(dispatch, NULL, &det) == NO_THREAD) return -1;
+  q->running = 1;
+  return 0;
+}
+
+static int dispatch(void *unused){
+  (void)unused;
+  task_queue *q = rt_tasks();
+  thread me = cur_thread();
+  for (int n = 1; q->head; n++){
+    struct task_rec *t = q->head;
+    q->head = t->next;
+    if (!q->head) q->tail = NULL;
+    lwpfun fn = t->fn;
+    void *arg = t->arg;
+    slab_free(&task_slab, t);
+
+    me->flags |= LWPF_TASK;
+    fn(arg);
+    if (!(me->flags & LWPF_TASK)) return 0;    // promoted: not ours any more
+    me->flags &= ~LWPF_TASK;
+    if (me->flags & LWPF_KEYS) keys_clear(me);  // keys are per task
+    if (n == TASK_BATCH){
+      n = 0;
+      lwp_yield();
+    }
+  }
+  q->running = 0;
+  return 0;
+}
+
+// t, a dispatcher in the middle of a task, is about to block or exit
+void task_promote(thread t){
+  task_queue *q = rt_tasks();
+  t->flags &= ~LWPF_TASK;
+  q->running = 0;
+  if (q->head) start_dispatcher(q);   // else the next submit starts one
+}
+
+int lwp_submit(lwpfun fn, void *arg){
+  if (!fn) return -1;
+  task_queue *q = rt_tasks();
+  struct task_rec *t = (struct task_rec*)slab_alloc(&task_slab);
+  if (!t) return -1;
+  t->fn   = fn;
+  t->arg  = arg;
+  t->next = NULL;
+  if (!q->running && start_dispatcher(q)){
+    slab_free(&task_slab, t);
+    return -1;
+  }
+  if (q->tail) q->tail->next = t;
+  else         q->head = t;
+  q->tail = t;
+  return 0;
+}
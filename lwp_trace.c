@@ -0,0 +1,83 @@
+#include "lwp.h"
+#include "tsc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Context-switch event ring.
+ *
+ * There is exactly one producer (whoever is running LWPs), so the ring
+ * needs no locks: the producer fills a slot and then publishes it by
+ * bumping head with a release store.  Once the ring wraps the oldest
+ * events are overwritten, which is what you want for "what happened
+ * just before it stalled".
+ */
+int lwp_trace_on = 0;
+
+static lwp_trace_ev *ring = NULL;
+static unsigned long ring_mask = 0;
+static unsigned long head = 0;         // total events ever emitted
+
+// tsc: when it happened, if the caller has just read it anyway
+void trace_emit_at(unsigned long tsc, unsigned type, unsigned long a,
+                   unsigned long b){
+  unsigned long h = head;
+  lwp_trace_ev *e = &ring[h & ring_mask];
+  e->tsc  = tsc;
+  e->type = type;
+  e->a    = a;
+  e->b    = b;
+  __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+}
+
+void trace_emit(unsigned type, unsigned long a, unsigned long b){
+  trace_emit_at(tsc_now(), type, a, b);
+}
+
+// Start tracing into a ring of at least nevents (rounded up to 2^k)
+int lwp_trace_start(size_t nevents){
+  size_t n = 1024;
+  while (n < nevents) n <<= 1;
+
+  if (n != ring_mask + 1 || !ring){
+    lwp_trace_ev *r = (lwp_trace_ev*)calloc(n, sizeof(*r));
+    if (!r) return -1;
+    lwp_trace_on = 0;
+    free(ring);
+    ring = r;
+    ring_mask = n - 1;
+  }
+  head = 0;
+  lwp_trace_on = 1;
+  return 0;
+}
+
+// Stop recording; the ring is kept so it can still be saved
+void lwp_trace_stop(void){
+  lwp_trace_on = 0;
+}
+
+// Write the ring, oldest event first, in the lwptrace2json input format
+int lwp_trace_save(const char *path){
+  if (!ring) return -1;
+  FILE *f = fopen(path, "wb");
+  if (!f) return -1;
+
+  unsigned long h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  unsigned long size = ring_mask + 1;
+  unsigned long first = h > size ? h - size : 0;
+
+  lwp_trace_hdr hdr;
+  memset(&hdr, 0, sizeof hdr);
+  memcpy(hdr.magic, LWP_TRACE_MAGIC, sizeof hdr.magic);
+  hdr.tsc_hz  = tsc_hz();
+  hdr.count   = h - first;
+  hdr.dropped = first;
+
+  int rc = fwrite(&hdr, sizeof hdr, 1, f) == 1 ? 0 : -1;
+  for (unsigned long i = first; rc == 0 && i < h; i++)
+    if (fwrite(&ring[i & ring_mask], sizeof *ring, 1, f) != 1) rc = -1;
+
+  if (fclose(f)) rc = -1;
+  return rc;
+}
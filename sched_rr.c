@@ -1,44 +1,49 @@
 #include "lwp.h"
-#include <stdlib.h>
 
-typedef struct node { thread t; struct node *next; } node;
-static node *head = NULL, *tail = NULL;
+/* Round robin over an intrusive doubly-linked queue: sched_one is the
+ * next thread, sched_two the previous one.  Both live in the control
+ * block's first cache line, so admit/next/remove are O(1) and never
+ * allocate.
+ */
+#define rr_next_of(t) ((t)->sched_one)
+#define rr_prev_of(t) ((t)->sched_two)
 
+/* The queue itself belongs to the bound runtime (see rt_rr()), so one
+ * RR instance serves every runtime.
+ */
 static void rr_remove(thread t);
 
 static void rr_init(void){
-  head = tail = NULL;
+  rr_queue *q = rt_rr();
+  q->head = q->tail = NULL;
+  q->count = 0;
 }
 
 // Tear down the RR scheduler
 static void rr_shutdown(void){
-  while (head) {
-    node *n = head;
-    head = head->next;
-    free(n);
+  rr_queue *q = rt_rr();
+  while (q->head) {
+    thread t = q->head;
+    q->head = rr_next_of(t);
+    rr_next_of(t) = rr_prev_of(t) = NULL;
   }
-  tail = NULL;
+  q->tail = NULL;
+  q->count = 0;
 }
 
 // Remove a thread from the RR queue
 static void rr_remove(thread t){
-  if (!t || !head) return;
+  rr_queue *q = rt_rr();
+  if (!t || !q->head) return;
+  if (t != q->head && !rr_prev_of(t)) return;    // not queued
 
-  node **pp = &head;
-  while (*pp) {
-    if ((*pp)->t == t) {
-      node *dead = *pp;
-      *pp = dead->next;
-      if (dead == tail) {
-        tail = NULL;
-        for (node *p = head; p; p = p->next) tail = p;
-      }
+  if (rr_prev_of(t)) rr_next_of(rr_prev_of(t)) = rr_next_of(t);
+  else               q->head = rr_next_of(t);
+  if (rr_next_of(t)) rr_prev_of(rr_next_of(t)) = rr_prev_of(t);
+  else               q->tail = rr_prev_of(t);
 
-      free(dead);
-      return;
-    }
-    pp = &(*pp)->next;
-  }
+  rr_next_of(t) = rr_prev_of(t) = NULL;
+  q->count--;
 }
 
 // Admit a thread to the RR queue
@@ -47,35 +52,34 @@ static void rr_admit(thread t){
 
   rr_remove(t);
 
-  node *n = (node*)malloc(sizeof(*n));
-  if (!n) return;
-  n->t = t;
-  n->next = NULL;
-
-  if (!tail) {
-    head = tail = n;
+  rr_queue *q = rt_rr();
+  rr_next_of(t) = NULL;
+  rr_prev_of(t) = q->tail;
+  if (!q->tail) {
+    q->head = q->tail = t;
   } else {
-    tail->next = n;
-    tail = n;
+    rr_next_of(q->tail) = t;
+    q->tail = t;
   }
+  q->count++;
 }
 
 // Select the next thread from the RR queue
 static thread rr_next(void){
-  if (!head) return NULL;
-  node *n = head;
-  head = head->next;
-  if (!head) tail = NULL;
-  thread t = n->t;
-  free(n);
+  rr_queue *q = rt_rr();
+  if (!q->head) return NULL;
+  thread t = q->head;
+  q->head = rr_next_of(t);
+  if (q->head) rr_prev_of(q->head) = NULL;
+  else         q->tail = NULL;
+  rr_next_of(t) = NULL;
+  q->count--;
   return t;
 }
 
 // Get the length of the RR queue
 static int rr_qlen(void){
-  int k = 0;
-  for (node *p = head; p; p = p->next) k++;
-  return k;
+  return rt_rr()->count;
 }
 
 // The RR scheduler instance
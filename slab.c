@@ -0,0 +1,118 @@
+#include "slab.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SLAB_BYTES (256 * 1024)
+
+// A fresh slab of at least len bytes
+static void *slab_map(slab_cache *c, size_t *len){
+  if (c->flags & SLAB_HUGE){
+    *len = (*len + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+    void *m = huge_map(*len, NULL);
+    return m ? m : MAP_FAILED;
+  }
+  return mmap(NULL, *len, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+void *slab_alloc(slab_cache *c){
+  void *p = c->free;
+  if (p){
+    c->free = *(void**)p;
+  } else {
+    if (c->cur + c->size > c->end){
+      size_t len = SLAB_BYTES > c->size ? SLAB_BYTES : c->size;
+      void *m = slab_map(c, &len);
+      if (m == MAP_FAILED) return NULL;
+      c->cur = (char*)m;                  // page aligned, so align holds
+      c->end = c->cur + len;
+    }
+    p = c->cur;
+    c->cur += c->size;
+  }
+  c->inuse++;
+  if (!(c->flags & SLAB_NOZERO)) memset(p, 0, c->size);
+  return p;
+}
+
+// n adjacent objects, bypassing the free list so they form one array
+size_t slab_alloc_array(slab_cache *c, void **out, size_t n){
+  if (c->cur + n * c->size > c->end){
+    size_t len = n * c->size;
+    if (len < SLAB_BYTES) len = SLAB_BYTES;
+    void *m = slab_map(c, &len);
+    if (m == MAP_FAILED) return 0;
+    c->cur = (char*)m;                    // the old tail is abandoned
+    c->end = c->cur + len;
+  }
+  for (size_t i = 0; i < n; i++){
+    out[i] = c->cur;                      // fresh pages are already zero
+    c->cur += c->size;
+  }
+  c->inuse += n;
+  return n;
+}
+
+void slab_free(slab_cache *c, void *p){
+  if (!p) return;
+  *(void**)p = c->free;
+  c->free = p;
+  c->inuse--;
+}
+
+/* Huge pages.  MAP_HUGETLB needs pages reserved in vm.nr_hugepages and
+ * fails outright without them; transparent huge pages only need a
+ * 2 MiB aligned range and MADV_HUGEPAGE (unless THP is "never").
+ * Either way the caller gets memory: huge_map() falls back one step at
+ * a time and reports in *kind what it got.
+ */
+static int thp_enabled(void){
+  char buf[64] = "";
+  FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (!f) return 0;
+  if (!fgets(buf, sizeof buf, f)) buf[0] = 0;
+  fclose(f);
+  return buf[0] && !strstr(buf, "[never]");
+}
+
+int huge_probe(void){
+#ifdef MAP_HUGETLB
+  void *m = mmap(NULL, HUGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (m != MAP_FAILED){
+    munmap(m, HUGE_SIZE);
+    return HUGE_TLB;
+  }
+#endif
+  return thp_enabled() ? HUGE_THP : HUGE_NONE;
+}
+
+void *huge_map(size_t len, int *kind){
+  len = (len + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+  int k = HUGE_TLB;
+  void *m = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  m = mmap(NULL, len, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (m == MAP_FAILED){
+    // over-map by one huge page and trim to a 2 MiB aligned range
+    char *r = mmap(NULL, len + HUGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) return NULL;
+    char *a = (char*)(((uintptr_t)r + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+    if (a > r) munmap(r, (size_t)(a - r));
+    if (a + len < r + len + HUGE_SIZE)
+      munmap(a + len, (size_t)(r + len + HUGE_SIZE - (a + len)));
+    m = a;
+#ifdef MADV_HUGEPAGE
+    k = madvise(m, len, MADV_HUGEPAGE) ? HUGE_NONE : HUGE_THP;
+#else
+    k = HUGE_NONE;
+#endif
+  }
+  if (kind) *kind = k;
+  return m;
+}
@@ -0,0 +1,43 @@
+#ifndef SLABH
+#define SLABH
+
+#include <stddef.h>
+
+/* Fixed-size object caches carved out of page-backed slabs.
+ *
+ * Objects come from large anonymous mappings instead of one malloc
+ * each, so consecutively allocated objects are adjacent and aligned,
+ * and a freed object goes on a free list to be handed out next.
+ * Slabs are never returned to the system.
+ *
+ * A SLAB_HUGE cache takes its slabs in 2 MiB huge-page units (see
+ * huge_map()), so everything it hands out shares a few TLB entries.
+ */
+#define SLAB_HUGE   0x1         // slabs from huge_map()
+#define SLAB_NOZERO 0x2         // don't zero objects (e.g. stacks)
+
+typedef struct slab_cache {
+  size_t size;                  // object size, a multiple of align
+  size_t align;
+  void   *free;                 // free list threaded through objects
+  char   *cur, *end;            // unused tail of the newest slab
+  size_t inuse;                 // objects handed out
+  unsigned flags;               // SLAB_*
+} slab_cache;
+
+#define SLAB_ROUND(sz, al) ((((sz) + (al) - 1) / (al)) * (al))
+#define SLAB_CACHE(type, al) { SLAB_ROUND(sizeof(type), al), al, NULL, NULL, NULL, 0, 0 }
+
+extern void *slab_alloc(slab_cache *c);          // zero-filled
+extern size_t slab_alloc_array(slab_cache *c, void **out, size_t n);
+extern void  slab_free(slab_cache *c, void *p);
+
+// Huge-page backed memory: MAP_HUGETLB, else THP-advised, else plain
+#define HUGE_SIZE (2UL << 20)
+#define HUGE_NONE 0
+#define HUGE_TLB  1
+#define HUGE_THP  2
+extern int   huge_probe(void);                   // best kind available
+extern void *huge_map(size_t len, int *kind);    // len rounded to HUGE_SIZE
+
+#endif
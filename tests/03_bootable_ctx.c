@@ -5,17 +5,28 @@
 static int sample(void *p){ (void)p; return 42; }
 
 int main(void){
-    tid_t t = lwp_create(sample, (void*)0xdeadbeef);
+    // lwp_create defers the stack and registers to the first dispatch
+    tid_t lazy = lwp_create(sample, (void*)0xdeadbeef);
+    thread lz = tid2thread(lazy);
+    if(!lz){ puts("tid2thread failed"); return 1; }
+    if(lz->state || lz->stack){ puts("lwp_create set up a stack early"); return 1; }
+    if(lz->entry != sample || lz->arg != (void*)0xdeadbeef){ puts("entry not kept"); return 1; }
+
+    // lwp_create_on has its memory already, so it boots the thread up front
+    static lwp_tcb tcb __attribute__((aligned(64)));
+    static char stack[16384] __attribute__((aligned(16)));
+    tid_t t = lwp_create_on(sample, (void*)0xdeadbeef, &tcb, stack, sizeof stack, NULL, NULL);
+    if(t == NO_THREAD){ puts("lwp_create_on failed"); return 1; }
     thread th = tid2thread(t);
     if(!th){ puts("tid2thread failed"); return 1; }
 
     // ABI args
-    if(th->state.rdi != (unsigned long)sample){ puts("rdi not set"); return 1; }
-    if(th->state.rsi != (unsigned long)0xdeadbeef){ puts("rsi not set"); return 1; }
+    if(th->state->rdi != (unsigned long)sample){ puts("rdi not set"); return 1; }
+    if(th->state->rsi != (unsigned long)0xdeadbeef){ puts("rsi not set"); return 1; }
 
     // saved rsp/rbp relation for leave; ret
-    uintptr_t rsp = (uintptr_t)th->state.rsp;
-    uintptr_t rbp = (uintptr_t)th->state.rbp;
+    uintptr_t rsp = (uintptr_t)th->state->rsp;
+    uintptr_t rbp = (uintptr_t)th->state->rbp;
 
     if((rsp & 0xF) != 0){ puts("saved rsp not 16B aligned"); return 1; }
     if(rbp != rsp){ puts("rbp != rsp (expected equal for fake frame)"); return 1; }
@@ -0,0 +1,41 @@
+// 13_sched_hist.c
+#include <stdio.h>
+#include "lwp.h"
+
+static int spin(void *p){
+  for(long i=0;i<(long)p;i++) lwp_yield();
+  return 0;
+}
+
+int main(void){
+  lwp_hist_per_thread(1);
+  tid_t a = lwp_create(spin, (void*)50);
+  lwp_create(spin, (void*)50);
+  lwp_create(spin, (void*)50);
+
+  // keep a alive for the per-thread lookup after the run
+  lwp_start();
+
+  lwp_hist h;
+  if(lwp_hist_sched(lwp_get_scheduler(), &h)){ puts("no sched hist"); return 1; }
+  printf("sched samples=%lu\n", h.count);
+  if(h.count < 150){ puts("too few samples"); return 1; }
+
+  unsigned long p50 = lwp_hist_quantile(&h, 0.50);
+  unsigned long p99 = lwp_hist_quantile(&h, 0.99);
+  unsigned long mx  = lwp_hist_quantile(&h, 1.0);
+  if(p50 > p99 || p99 > mx){ puts("quantiles not monotone"); return 1; }
+
+  lwp_hist th;
+  if(lwp_hist_thread(a, &th) || th.count == 0){ puts("no thread hist"); return 1; }
+  if(th.count > h.count){ puts("thread hist exceeds sched hist"); return 1; }
+  lwp_hist_dump(stdout);
+
+  lwp_hist_reset();
+  lwp_hist_sched(lwp_get_scheduler(), &h);
+  if(h.count != 0 || h.max != 0){ puts("reset failed"); return 1; }
+
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  puts("OK: run-queue wait histograms");
+  return 0;
+}
@@ -0,0 +1,50 @@
+// 14_trace.c
+#include <stdio.h>
+#include <string.h>
+#include "lwp.h"
+
+static int hop(void *p){
+  for(long i=0;i<(long)p;i++) lwp_yield();
+  return 3;
+}
+
+int main(void){
+  const char *path = "tmpfile.trace";
+  if(lwp_trace_start(4096)){ puts("trace start failed"); return 1; }
+
+  lwp_create(hop, (void*)5);
+  lwp_create(hop, (void*)5);
+  lwp_start();
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  lwp_set_scheduler(NULL);
+
+  lwp_trace_stop();
+  if(lwp_trace_save(path)){ puts("trace save failed"); return 1; }
+
+  FILE *f = fopen(path, "rb");
+  lwp_trace_hdr hdr;
+  if(!f || fread(&hdr, sizeof hdr, 1, f) != 1){ puts("trace unreadable"); return 1; }
+  if(memcmp(hdr.magic, LWP_TRACE_MAGIC, 8)){ puts("bad magic"); return 1; }
+
+  int seen[6] = {0};
+  unsigned long last = 0;
+  lwp_trace_ev e;
+  for(unsigned long i=0;i<hdr.count;i++){
+    if(fread(&e, sizeof e, 1, f) != 1){ puts("short trace"); return 1; }
+    if(e.tsc < last){ puts("timestamps went backwards"); return 1; }
+    last = e.tsc;
+    if(e.type < 6) seen[e.type]++;
+  }
+  fclose(f);
+  remove(path);
+
+  printf("events=%lu create=%d switch=%d exit=%d wait=%d\n", hdr.count,
+         seen[LWP_EV_CREATE], seen[LWP_EV_SWITCH], seen[LWP_EV_EXIT],
+         seen[LWP_EV_WAIT]);
+  if(seen[LWP_EV_CREATE] != 2 || seen[LWP_EV_EXIT] != 2 ||
+     seen[LWP_EV_WAIT] != 2 || seen[LWP_EV_SWITCH] < 12){
+    puts("missing events"); return 1;
+  }
+  puts("OK: context-switch tracing");
+  return 0;
+}
@@ -0,0 +1,84 @@
+// 15_stats_segment.c
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "lwp.h"
+
+static const lwp_stats_seg *seg;
+
+static int worker(void *p){
+  for(long i=0;i<(long)p;i++) lwp_yield();
+  return 0;
+}
+
+// Read-only view, the same way lwptop maps it
+static int peek(lwp_stats_seg *out){
+  unsigned long s1;
+  do {
+    s1 = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+    *out = *seg;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while((s1 & 1) || __atomic_load_n(&seg->seq, __ATOMIC_RELAXED) != s1);
+  return 0;
+}
+
+static lwp_stats_seg snap;
+
+int main(void){
+  char name[64];
+  snprintf(name, sizeof name, "/lwp-test-%ld", (long)getpid());
+
+  tid_t early = lwp_create(worker, (void*)10);   // before publishing
+  if(lwp_stats_publish(name)){ puts("publish failed"); return 1; }
+  lwp_create(worker, (void*)10);
+  lwp_create(worker, (void*)10);
+
+  int fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0){ puts("segment not visible"); return 1; }
+  seg = mmap(NULL, sizeof *seg, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(seg == MAP_FAILED || seg->magic != LWP_STATS_MAGIC){ puts("bad segment"); return 1; }
+
+  peek(&snap);
+  if(snap.creates != 3 || snap.thr[0].tid != early){ puts("existing threads not attached"); return 1; }
+
+  lwp_start();
+  peek(&snap);
+  printf("switches=%lu creates=%lu exits=%lu\n", snap.switches, snap.creates, snap.exits);
+  if(snap.switches < 30 || snap.exits != 3){ puts("counters wrong"); return 1; }
+  if(snap.creates != snap.exits){ puts("main counted as live"); return 1; }
+
+  unsigned long sw = 0;
+  for(unsigned long i=0;i<snap.nslots;i++)
+    if(snap.thr[i].tid == early){
+      sw = snap.thr[i].switches;
+      if(snap.thr[i].state != LWP_ST_EXITED){ puts("state not exited"); return 1; }
+    }
+  if(sw < 10){ puts("per-thread switches missing"); return 1; }
+
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  peek(&snap);
+  if(snap.reaps != 3){ puts("reaps not counted"); return 1; }
+
+  lwp_stats_unpublish();
+  if(shm_open(name, O_RDONLY, 0) >= 0){ puts("segment not removed"); return 1; }
+
+  // exited but not reaped at publish time: a slot, but not live
+  lwp_create(worker, (void*)1);
+  lwp_yield();                                  // runs it to its exit
+  lwp_create(worker, (void*)1);                 // not run yet
+  munmap((void*)seg, sizeof *seg);
+  if(lwp_stats_publish(name)){ puts("republish failed"); return 1; }
+  fd = shm_open(name, O_RDONLY, 0);
+  seg = mmap(NULL, sizeof *seg, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  peek(&snap);
+  if(snap.creates - snap.exits != 1){ printf("live %lu (%lu - %lu), want 1\n", snap.creates - snap.exits, snap.creates, snap.exits); return 1; }
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  peek(&snap);
+  if(snap.creates != snap.exits){ puts("live after reaping all"); return 1; }
+  lwp_stats_unpublish();
+  puts("OK: shared-memory stats segment");
+  return 0;
+}
@@ -0,0 +1,52 @@
+// 16_prof.c
+#include <stdio.h>
+#include <string.h>
+#include "lwp.h"
+
+// exported (see -rdynamic in the Makefile) so the dump can name them
+volatile double sink;
+
+// the volatile local forces a real frame even though this is a leaf
+__attribute__((noinline)) void burn_inner(int n){
+  volatile double x = 1.0;
+  for(int i=0;i<n;i++) x = x * 1.0000001 + 1e-9;
+  sink = x;
+}
+
+__attribute__((noinline)) int burner(void *p){
+  for(int r=0;r<(int)(long)p;r++){
+    burn_inner(200000);
+    lwp_yield();
+  }
+  return 0;
+}
+
+int main(void){
+  if(lwp_prof_start(1000, 100000)){ puts("prof start failed"); return 1; }
+  tid_t a = lwp_create(burner, (void*)300);
+  tid_t b = lwp_create(burner, (void*)300);
+  lwp_start();
+  lwp_prof_stop();
+
+  size_t na = lwp_prof_count(a), nb = lwp_prof_count(b);
+  printf("samples: total=%zu a=%zu b=%zu\n", lwp_prof_count(NO_THREAD), na, nb);
+  if(na < 5 || nb < 5){ puts("LWPs not sampled"); return 1; }
+
+  FILE *f = fopen("tmpfile.folded", "w+");
+  lwp_prof_dump(f);
+  rewind(f);
+
+  char line[4096], want[64];
+  snprintf(want, sizeof want, "lwp-%lu;", (unsigned long)a);
+  int hits = 0;
+  while(fgets(line, sizeof line, f))
+    if(!strncmp(line, want, strlen(want)) && strstr(line, "burner;burn_inner "))
+      hits++;
+  fclose(f);
+  remove("tmpfile.folded");
+
+  if(!hits){ puts("no folded stack through burner;burn_inner"); return 1; }
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  puts("OK: SIGPROF profiler attributes samples to LWPs");
+  return 0;
+}
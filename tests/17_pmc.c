@@ -0,0 +1,38 @@
+// 17_pmc.c
+#include <stdio.h>
+#include "lwp.h"
+
+static volatile double sink;
+
+static int heavy(void *p){
+  for(int r=0;r<20;r++){
+    volatile double x = 1.0;
+    for(long i=0;i<(long)p;i++) x = x * 1.0000001;
+    sink = x;
+    lwp_yield();
+  }
+  return 0;
+}
+
+int main(void){
+  int mode = lwp_pmc_enable();
+  if(mode < 0){ puts("SKIP: no perf events available"); return 0; }
+  printf("pmc mode=%s\n", mode == LWP_PMC_HW ? "hw" : "sw");
+
+  tid_t big   = lwp_create(heavy, (void*)2000000);
+  tid_t small = lwp_create(heavy, (void*)20000);
+  lwp_start();
+
+  lwp_pmc pb, ps;
+  if(lwp_pmc_read(big, &pb) || lwp_pmc_read(small, &ps)){ puts("read failed"); return 1; }
+  for(int i=0;i<LWP_PMC_MAX;i++)
+    printf("%-16s big=%lu small=%lu\n", lwp_pmc_name(i), pb.v[i], ps.v[i]);
+  lwp_pmc_disable();
+
+  // counter 0 is cycles or task-clock: both scale with work done
+  if(pb.v[0] == 0 || pb.v[0] < 10 * ps.v[0]){ puts("deltas not attributed"); return 1; }
+
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  puts("OK: per-LWP counters follow the context");
+  return 0;
+}
@@ -0,0 +1,52 @@
+// 18_create_many.c
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "lwp.h"
+
+#define N 500
+
+static int ret_arg(void *p){
+  lwp_yield();
+  return (int)(intptr_t)p;
+}
+
+int main(void){
+  void *args[N];
+  tid_t tids[N];
+  for(int i=0;i<N;i++) args[i] = (void*)(intptr_t)(i & 0xFF);
+
+  size_t got = lwp_create_many(ret_arg, args, N, tids);
+  if(got != N){ printf("created %zu of %d\n", got, N); return 1; }
+
+  // one reservation: each stack sits a page above the previous one,
+  // and like lwp_create nothing is set up before the first dispatch
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  for(int i=1;i<N;i++){
+    thread a = tid2thread(tids[i-1]), b = tid2thread(tids[i]);
+    if(!a || !b || tids[i] != tids[i-1] + 1){ puts("bad tids"); return 1; }
+    if((char*)b->stack != (char*)a->stack + a->stacksize + page){
+      puts("stacks not contiguous"); return 1;
+    }
+    if(b->state || b->guardsize){ puts("set up before first dispatch"); return 1; }
+  }
+  if(lwp_get_scheduler()->qlen() != N){ puts("batch not admitted"); return 1; }
+
+  lwp_start();
+
+  // the ones still to be reaped have run, so they have their guards now
+  for(int i=0;i<N;i++){
+    thread t = tid2thread(tids[i]);
+    if(!t || t->guardsize != page){ puts("no guard page after running"); return 1; }
+  }
+
+  int s, bad = 0;
+  for(int i=0;i<N;i++){
+    tid_t t = lwp_wait(&s);
+    if(t != tids[i] || LWPTERMSTAT(s) != (i & 0xFF)) bad++;
+  }
+  if(bad){ printf("%d threads reaped out of order or with wrong status\n", bad); return 1; }
+  if(lwp_wait(NULL) != NO_THREAD){ puts("extra thread"); return 1; }
+  puts("OK: lwp_create_many");
+  return 0;
+}
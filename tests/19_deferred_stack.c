@@ -0,0 +1,61 @@
+// 19_deferred_stack.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define N 20000
+
+static long ran = 0;
+
+static int note_stack(void *p){
+  thread me = tid2thread(lwp_gettid());
+  if(!me || !me->stack || !me->state) return 0xEE;
+  char here;
+  if(&here < (char*)me->stack || &here >= (char*)me->stack + me->stacksize)
+    return 0xEF;
+  ran++;
+  lwp_yield();
+  return (int)(intptr_t)p;
+}
+
+// Address-space size in pages from /proc/self/statm
+static long vm_pages(void){
+  long size = -1;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if(f){
+    if(fscanf(f, "%ld", &size) != 1) size = -1;
+    fclose(f);
+  }
+  return size;
+}
+
+int main(void){
+  long before = vm_pages();
+  static tid_t tids[N];
+  for(int i=0;i<N;i++){
+    tids[i] = lwp_create(note_stack, (void*)(intptr_t)(i & 0x7F));
+    if(tids[i] == NO_THREAD){ printf("create %d failed\n", i); return 1; }
+  }
+  long after = vm_pages();
+
+  // N queued threads must not have reserved N stacks (1 MiB each)
+  long grew_kb = (after - before) * 4;
+  if(grew_kb > N / 2){ printf("address space grew %ld KiB for %d pending threads\n", grew_kb, N); return 1; }
+  for(int i=0;i<N;i+=997){
+    thread t = tid2thread(tids[i]);
+    if(!t || t->state || t->stack){ puts("thread materialized before dispatch"); return 1; }
+  }
+
+  lwp_start();
+
+  int s, bad = 0;
+  for(int i=0;i<N;i++){
+    tid_t t = lwp_wait(&s);
+    if(t != tids[i] || LWPTERMSTAT(s) != (i & 0x7F)) bad++;
+  }
+  if(bad){ printf("%d threads reaped wrong\n", bad); return 1; }
+  if(ran != N){ printf("%ld of %d ran on their own stack\n", ran, N); return 1; }
+  if(lwp_wait(NULL) != NO_THREAD){ puts("extra thread"); return 1; }
+  puts("OK: deferred stack materialization");
+  return 0;
+}
@@ -0,0 +1,95 @@
+// 20_shared_stack.c
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "lwp.h"
+
+#define NSHARED  200
+#define NPRIVATE 20
+#define ROUNDS   50
+
+static char *seen_base = NULL;
+static int wrong_base = 0;
+
+// Keep a tid-specific pattern live across yields; any copy error shows up
+static int worker(void *p){
+  long id = (long)(intptr_t)p;
+  unsigned char buf[1500];
+  for(unsigned i=0;i<sizeof buf;i++) buf[i] = (unsigned char)(id * 31 + i);
+
+  thread me = tid2thread(lwp_gettid());
+  if(me->flags & LWPF_SHARED){
+    if(!seen_base) seen_base = (char*)me->stack;
+    if((char*)me->stack != seen_base) wrong_base++;
+    if((unsigned char*)buf < (unsigned char*)me->stack ||
+       (unsigned char*)buf >= (unsigned char*)me->stack + me->stacksize) wrong_base++;
+  }
+
+  for(int r=0;r<ROUNDS;r++){
+    lwp_yield();
+    for(unsigned i=0;i<sizeof buf;i++)
+      if(buf[i] != (unsigned char)(id * 31 + i)) return 0xEE;
+    buf[r] ^= 0x5A;                      // change something every round
+    buf[r] ^= 0x5A;
+  }
+  return (int)(id & 0x7F);
+}
+
+// Shared threads of one group share a stack; other groups have their own
+static char *group_base[3];
+static int group_wrong = 0;
+
+static int grouped(void *p){
+  long g = (long)(intptr_t)p;
+  char *base = (char*)tid2thread(lwp_gettid())->stack;
+  if(!group_base[g]) group_base[g] = base;
+  if(base != group_base[g]) group_wrong++;
+  lwp_set_group(lwp_gettid(), 2);        // keeps the stack it started on
+  lwp_yield();
+  if((char*)tid2thread(lwp_gettid())->stack != base) group_wrong++;
+  return 0;
+}
+
+int main(void){
+  lwp_attr shared = { LWP_ATTR_SHARED_STACK, 0 };
+  tid_t tids[NSHARED + NPRIVATE];
+  int n = 0;
+  for(int i=0;i<NSHARED;i++){
+    tids[n] = lwp_create_attr(worker, (void*)(intptr_t)n, &shared);
+    if(tids[n++] == NO_THREAD){ puts("create_attr failed"); return 1; }
+    if(i % 10 == 0){                     // interleave some private stacks
+      tids[n] = lwp_create(worker, (void*)(intptr_t)n);
+      n++;
+    }
+  }
+
+  lwp_start();
+
+  int s, bad = 0;
+  for(int i=0;i<n;i++){
+    tid_t t = lwp_wait(&s);
+    if(t != tids[i] || LWPTERMSTAT(s) != (i & 0x7F)){
+      printf("tid %lu status %d (want %lu/%d)\n", t, LWPTERMSTAT(s), tids[i], i & 0x7F);
+      bad++;
+    }
+  }
+  if(bad){ printf("%d threads corrupted or out of order\n", bad); return 1; }
+  if(!seen_base || wrong_base){ puts("shared threads not on one shared stack"); return 1; }
+  if(lwp_wait(NULL) != NO_THREAD){ puts("extra thread"); return 1; }
+
+  for(int g=1;g<=2;g++){
+    lwp_set_group(lwp_gettid(), (unsigned)g);   // new LWPs inherit it
+    for(int i=0;i<4;i++) lwp_create_attr(grouped, (void*)(intptr_t)g, &shared);
+  }
+  lwp_set_group(lwp_gettid(), 0);
+  while(lwp_wait(NULL) != NO_THREAD)
+    ;
+  if(group_wrong || !group_base[1] || !group_base[2]
+     || group_base[1] == group_base[2] || group_base[1] == seen_base
+     || group_base[2] == seen_base){
+    puts("shared stacks not one per group");
+    return 1;
+  }
+  puts("OK: shared stack");
+  return 0;
+}
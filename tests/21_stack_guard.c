@@ -0,0 +1,104 @@
+// 21_stack_guard.c
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lwp.h"
+
+// Use about p bytes of stack, then yield so the depth is visible live
+static int use_stack(void *p){
+  size_t n = (size_t)(intptr_t)p;
+  volatile char buf[n];
+  memset((char*)buf, 0, n);
+  lwp_yield();
+  return buf[n / 2];
+}
+
+static int recurse(int depth){
+  volatile char pad[512];
+  pad[0] = (char)depth;
+  if(depth < 0) return 0;               // never: keeps gcc from complaining
+  return recurse(depth + 1) + pad[0];
+}
+
+static int overflow(void *p){
+  (void)p;
+  return recurse(0);
+}
+
+// Overflow a 64k stack in a forked child; 0 if it reported and died
+static void *overflow_host(void *p){
+  (void)p;
+  lwp_runtime *r = lwp_runtime_create();
+  lwp_runtime_bind(r);
+  lwp_attr small = { 0, 64 * 1024 };
+  tid_t t = lwp_create_attr(overflow, NULL, &small);
+  fprintf(stderr, "tid %lu\n", t);
+  lwp_wait(NULL);
+  return NULL;
+}
+
+static int check_overflow(int other_pthread){
+  int fds[2];
+  if(pipe(fds)){ perror("pipe"); return 1; }
+  pid_t pid = fork();
+  if(pid == 0){
+    dup2(fds[1], STDERR_FILENO);
+    if(other_pthread){
+      lwp_create(use_stack, (void*)4096);   // main sets up the handler first
+      while(lwp_wait(NULL) != NO_THREAD) ;
+      pthread_t pt;
+      pthread_create(&pt, NULL, overflow_host, NULL);
+      pthread_join(pt, NULL);
+    } else {
+      overflow_host(NULL);
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  char msg[512] = "";
+  ssize_t n = 0, r;
+  while((r = read(fds[0], msg + n, sizeof msg - 1 - n)) > 0) n += r;
+  close(fds[0]);
+  int st;
+  waitpid(pid, &st, 0);
+  if(!WIFSIGNALED(st) || WTERMSIG(st) != SIGSEGV){ puts("child did not die of SIGSEGV"); return 1; }
+  unsigned long victim = 0;
+  char expect[64];
+  sscanf(msg, "tid %lu", &victim);
+  snprintf(expect, sizeof expect, "stack overflow in thread %lu ", victim);
+  if(!victim || !strstr(msg, expect) || !strstr(msg, "stack 65536 bytes")){
+    printf("bad report%s: %s\n", other_pthread ? " (other pthread)" : "", msg); return 1;
+  }
+  return 0;
+}
+
+int main(void){
+  // watermark: depth per thread and per entry function
+  lwp_stack_watermark(1);
+  static const size_t want[] = { 8192, 32768, 131072 };
+  tid_t tids[3];
+  for(int i=0;i<3;i++) tids[i] = lwp_create(use_stack, (void*)(intptr_t)want[i]);
+  lwp_start();
+  for(int i=0;i<3;i++){
+    long used = lwp_stack_used(tids[i]);
+    if(used < (long)want[i] || used > (long)want[i] + 16384){
+      printf("thread %d used %ld bytes, expected about %zu\n", i, used, want[i]); return 1;
+    }
+  }
+  lwp_hist h;
+  if(lwp_stack_hist(use_stack, &h) || h.count != 3 || h.max < 131072){
+    puts("per-entry depth histogram wrong"); return 1;
+  }
+  while(lwp_wait(NULL) != NO_THREAD) ;
+
+  // overflow: the child dies of SIGSEGV after naming the thread
+  if(check_overflow(0)) return 1;
+  // ...also in a runtime on a pthread other than the one that set up
+  if(check_overflow(1)) return 1;
+  puts("OK: stack guard and watermark");
+  return 0;
+}
@@ -0,0 +1,58 @@
+// 22_create_on.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define N     16
+#define STACK (32 * 1024)
+
+static lwp_tcb tcbs[N];
+static char stacks[N][STACK] __attribute__((aligned(4096)));
+static int released[N], bad_release = 0, ran_on_arena = 0;
+
+static int work(void *p){
+  char here;
+  int i = (int)(intptr_t)p;
+  if(&here >= stacks[i] && &here < stacks[i] + STACK) ran_on_arena++;
+  lwp_yield();
+  return i + 1;
+}
+
+static void give_back(lwp_tcb *tcb, void *stack, size_t size, void *arg){
+  int i = (int)(tcb - tcbs);
+  if(i < 0 || i >= N || stack != stacks[i] || size != STACK || arg != (void*)&tcbs)
+    bad_release++;
+  else
+    released[i]++;
+}
+
+// create all N on the arena, run and reap them; returns failures
+static int round_trip(int round){
+  tid_t tids[N];
+  for(int i=0;i<N;i++){
+    tids[i] = lwp_create_on(work, (void*)(intptr_t)i, &tcbs[i], stacks[i], STACK,
+                            give_back, &tcbs);
+    if(tids[i] == NO_THREAD){ printf("round %d: create_on failed\n", round); return 1; }
+    if(tid2thread(tids[i]) != &tcbs[i].ctx){ puts("tcb not used in place"); return 1; }
+  }
+  lwp_start();
+  for(int i=0;i<N;i++){
+    int s;
+    if(lwp_wait(&s) != tids[i] || LWPTERMSTAT(s) != i + 1){ puts("bad wait"); return 1; }
+    if(released[i] != round){ printf("thread %d released %d times\n", i, released[i]); return 1; }
+  }
+  return 0;
+}
+
+int main(void){
+  if(lwp_create_on(work, NULL, (lwp_tcb*)((char*)&tcbs[0] + 8), stacks[0], STACK,
+                   give_back, NULL) != NO_THREAD){
+    puts("misaligned tcb accepted"); return 1;
+  }
+  // the memory comes back after each reap, so it can be reused at once
+  for(int r=1;r<=3;r++) if(round_trip(r)) return 1;
+  if(bad_release){ puts("release callback got wrong arguments"); return 1; }
+  if(ran_on_arena != 3 * N){ printf("%d/%d ran on the caller's stack\n", ran_on_arena, 3 * N); return 1; }
+  puts("OK: lwp_create_on");
+  return 0;
+}
@@ -0,0 +1,67 @@
+// 23_hugepages.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define N     64
+#define STACK (64 * 1024)
+#define HUGE  (2UL << 20)
+
+static void *stk[N];
+
+static int note(void *p){
+  int i = (int)(intptr_t)p;
+  thread me = tid2thread(lwp_gettid());
+  stk[i] = me->stack;
+  lwp_yield();
+  return i;
+}
+
+static int run_batch(const lwp_attr *a){
+  tid_t tids[N];
+  for(int i=0;i<N;i++) tids[i] = lwp_create_attr(note, (void*)(intptr_t)i, a);
+  lwp_start();
+  for(int i=0;i<N;i++){
+    int s;
+    if(lwp_wait(&s) != tids[i] || LWPTERMSTAT(s) != i) return -1;
+  }
+  return 0;
+}
+
+int main(void){
+  lwp_attr small = { 0, STACK };
+  int kind = lwp_hugepages(1);
+  if(run_batch(&small)){ puts("huge batch failed"); return 1; }
+  if(!kind){
+    puts("OK: no huge pages here; fell back to plain stacks");
+    return 0;
+  }
+
+  // small stacks share huge pages: 32 to a 2 MiB page, no guard gaps
+  int shared = 0;
+  for(int i=1;i<N;i++){
+    if(((uintptr_t)stk[i] & ~(HUGE - 1)) == ((uintptr_t)stk[i-1] & ~(HUGE - 1)))
+      shared++;
+  }
+  if(shared < N - 1 - N / 32){ printf("only %d neighbours share a huge page\n", shared); return 1; }
+
+  // reaped stacks are reused from the cache
+  void *first[N];
+  for(int i=0;i<N;i++) first[i] = stk[i];
+  if(run_batch(&small)){ puts("second batch failed"); return 1; }
+  int reused = 0;
+  for(int i=0;i<N;i++)
+    for(int j=0;j<N;j++) if(stk[i] == first[j]){ reused++; break; }
+  if(reused != N){ printf("%d of %d stacks reused\n", reused, N); return 1; }
+
+  // and off again: back to guarded private stacks
+  lwp_hugepages(0);
+  tid_t t = lwp_create_attr(note, (void*)0, &small);
+  lwp_yield();
+  thread th = tid2thread(t);
+  if(!th || th->guardsize == 0 || (th->flags & LWPF_HUGE)){ puts("huge mode still on"); return 1; }
+  lwp_wait(NULL);
+
+  printf("OK: huge-page arenas (%s)\n", kind == LWP_HUGE_TLB ? "hugetlb" : "thp");
+  return 0;
+}
@@ -0,0 +1,73 @@
+// 24_detached.c
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "lwp.h"
+
+#define FIRE  1000000
+#define BATCH 100
+
+static long done = 0;
+
+static int fire(void *p){
+  (void)p;
+  done++;
+  return 0;
+}
+
+static int yield_then(void *p){
+  lwp_yield();
+  return (int)(intptr_t)p;
+}
+
+// Resident set in KiB
+static long rss_kb(void){
+  long size, res = -1;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if(f){
+    if(fscanf(f, "%ld %ld", &size, &res) != 2) res = -1;
+    fclose(f);
+  }
+  return res * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long peak = 0;
+static int spawner(void *p){
+  (void)p;
+  lwp_attr det = { LWP_ATTR_DETACHED, 0 };
+  for(long i=0;i<FIRE;i++){
+    if(lwp_create_attr(fire, NULL, &det) == NO_THREAD) return 1;
+    if(i % BATCH == BATCH - 1){
+      lwp_yield();                       // let the batch run and vanish
+      if(i % 65536 == BATCH - 1){ long r = rss_kb(); if(r > peak) peak = r; }
+    }
+  }
+  return 0;
+}
+
+int main(void){
+  // lwp_detach on a running thread, and on one that has already exited
+  tid_t a = lwp_create(yield_then, (void*)1);
+  tid_t b = lwp_create(yield_then, (void*)2);
+  tid_t c = lwp_create(yield_then, (void*)3);
+  if(lwp_detach(a)){ puts("detach failed"); return 1; }
+  lwp_start();
+  int s;
+  if(lwp_wait(&s) != b || LWPTERMSTAT(s) != 2){ puts("wait did not skip the detached thread"); return 1; }
+  if(!tid2thread(c) || !LWPTERMINATED(tid2thread(c)->status)){ puts("c should have exited"); return 1; }
+  if(lwp_detach(c) || tid2thread(c)){ puts("exited thread not freed by detach"); return 1; }
+  if(tid2thread(a)){ puts("detached thread not freed at exit"); return 1; }
+  if(lwp_wait(NULL) != NO_THREAD){ puts("detached thread reached lwp_wait"); return 1; }
+
+  // a million fire-and-forget threads in bounded memory
+  long before = rss_kb();
+  tid_t sp = lwp_create(spawner, NULL);
+  if(lwp_wait(&s) != sp || LWPTERMSTAT(s) != 0){ puts("spawner failed"); return 1; }
+  if(lwp_wait(NULL) != NO_THREAD){ puts("a detached thread was queued for wait"); return 1; }
+  if(done != FIRE){ printf("%ld of %d ran\n", done, FIRE); return 1; }
+  if(peak - before > 32 * 1024){
+    printf("RSS grew by %ld KiB for %d detached threads\n", peak - before, FIRE); return 1;
+  }
+  printf("OK: detached threads (RSS +%ld KiB)\n", peak - before);
+  return 0;
+}
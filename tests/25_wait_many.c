@@ -0,0 +1,58 @@
+// 25_wait_many.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define N 1000
+#define M 30
+
+static int ret_arg(void *p){
+  int i = (int)(intptr_t)p;
+  if(i % 3) lwp_yield();                 // exit out of creation order
+  return i & 0xFF;
+}
+
+int main(void){
+  void *args[N];
+  tid_t tids[N];
+  for(int i=0;i<N;i++) args[i] = (void*)(intptr_t)i;
+  if(lwp_create_many(ret_arg, args, N, tids) != N){ puts("create failed"); return 1; }
+
+  // nothing has exited yet: WNOHANG returns at once, without running anyone
+  tid_t got[N];
+  int st[N];
+  if(lwp_wait_many(got, st, N, LWP_WNOHANG) != 0){ puts("WNOHANG reaped early"); return 1; }
+  if(lwp_get_scheduler()->qlen() != N){ puts("WNOHANG ran threads"); return 1; }
+
+  // blocking, in chunks of at most 64
+  size_t n = 0;
+  while(n < N){
+    size_t k = lwp_wait_many(got + n, st + n, 64, 0);
+    if(k == 0 || k > 64){ printf("wait_many returned %zu\n", k); return 1; }
+    n += k;
+  }
+  for(int i=0;i<N;i++){
+    long idx = (long)(got[i] - tids[0]);
+    if(idx < 0 || idx >= N || !LWPTERMINATED(st[i]) || LWPTERMSTAT(st[i]) != (idx & 0xFF)){
+      printf("bad entry %d\n", i); return 1;
+    }
+    if(tid2thread(tids[i])){ puts("thread not freed"); return 1; }
+  }
+
+  // the same order and statuses as a run of lwp_wait() calls
+  tid_t a[M], b[M], one[M], many[M];
+  int sone[M], smany[M];
+  if(lwp_create_many(ret_arg, args, M, a) != M) return 1;
+  for(int i=0;i<M;i++) one[i] = lwp_wait(&sone[i]);
+  if(lwp_create_many(ret_arg, args, M, b) != M) return 1;
+  while(lwp_get_scheduler()->qlen()) lwp_yield();    // let them all exit
+  if(lwp_wait_many(many, smany, M, LWP_WNOHANG) != M){ puts("not all exited"); return 1; }
+  for(int i=0;i<M;i++){
+    if(many[i] - b[0] != one[i] - a[0]){ printf("order differs at %d\n", i); return 1; }
+    if(smany[i] != sone[i]){ printf("status differs at %d\n", i); return 1; }
+  }
+
+  if(lwp_wait_many(many, smany, M, 0) != 0){ puts("blocking wait_many with nothing left"); return 1; }
+  puts("OK: lwp_wait_many");
+  return 0;
+}
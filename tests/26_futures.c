@@ -0,0 +1,72 @@
+// 26_futures.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define FAN 100
+
+typedef struct { long in, out; } job;
+
+static void *square(void *p){
+  job *j = (job*)p;
+  for(long i=0;i<j->in % 5;i++) lwp_yield();
+  j->out = j->in * j->in;
+  return j;                              // a full pointer, not 8 bits
+}
+
+static void *slow_by(void *p){
+  for(long i=0;i<(long)(intptr_t)p;i++) lwp_yield();
+  return (void*)((intptr_t)p * 0x100000001L);
+}
+
+// an LWP that fans out and in itself
+static void *fan(void *p){
+  long n = (long)(intptr_t)p;
+  static job jobs[FAN];
+  lwp_future fs[FAN];
+  void *rs[FAN];
+  for(long i=0;i<n;i++){ jobs[i].in = i; fs[i] = lwp_spawn(square, &jobs[i]); }
+  lwp_await_all(fs, n, rs);
+  long sum = 0;
+  for(long i=0;i<n;i++){
+    if(rs[i] != &jobs[i]) return NULL;
+    sum += ((job*)rs[i])->out;
+  }
+  return (void*)sum;
+}
+
+int main(void){
+  // await from main, with the fan-out done by an LWP
+  long want = 0;
+  for(long i=0;i<FAN;i++) want += i * i;
+  lwp_future f = lwp_spawn(fan, (void*)(intptr_t)FAN);
+  if(!f){ puts("spawn failed"); return 1; }
+  if(lwp_future_ready(f)){ puts("ready before running"); return 1; }
+  void *r = lwp_await(f);
+  if((long)r != want){ printf("sum %ld, want %ld\n", (long)r, want); return 1; }
+
+  // await_any hands results back in completion order
+  lwp_future fs[3];
+  fs[0] = lwp_spawn(slow_by, (void*)30);
+  fs[1] = lwp_spawn(slow_by, (void*)3);
+  fs[2] = lwp_spawn(slow_by, (void*)10);
+  static const size_t order[3] = { 1, 2, 0 };
+  for(int k=0;k<3;k++){
+    size_t i = lwp_await_any(fs, 3, &r);
+    if(i != order[k]){ printf("await_any #%d gave %zu\n", k, i); return 1; }
+    long in = i == 0 ? 30 : i == 1 ? 3 : 10;
+    if(r != (void*)(in * 0x100000001L)){ puts("await_any result wrong"); return 1; }
+  }
+  if(lwp_await_any(fs, 3, &r) != 3){ puts("await_any on nothing"); return 1; }
+
+  // completed futures are pooled, and none of this touched lwp_wait
+  lwp_future a = lwp_spawn(slow_by, (void*)1);
+  lwp_await(a);
+  lwp_future b = lwp_spawn(slow_by, (void*)1);
+  if(b != a){ puts("future record not reused"); return 1; }
+  lwp_await(b);
+  tid_t t;
+  if(lwp_wait_many(&t, NULL, 1, LWP_WNOHANG) != 0){ puts("future reached the terminated FIFO"); return 1; }
+  puts("OK: futures");
+  return 0;
+}
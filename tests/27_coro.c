@@ -0,0 +1,86 @@
+// 27_coro.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+// generator: yields 0..n-1, returns -1
+static void *count(void *in){
+  long n = (long)(intptr_t)in;
+  for(long i=0;i<n;i++) lwp_coro_yield((void*)(intptr_t)i);
+  return (void*)(intptr_t)-1;
+}
+
+// running sum of whatever it is sent
+static void *summer(void *in){
+  long sum = 0;
+  for(;;){
+    sum += (long)(intptr_t)in;
+    in = lwp_coro_yield((void*)(intptr_t)sum);
+  }
+  return NULL;
+}
+
+// a coroutine driving another coroutine
+static void *doubler(void *in){
+  lwp_coro inner = lwp_coro_create(count, 0);
+  void *v = lwp_coro_resume(inner, in);
+  while(!lwp_coro_done(inner)){
+    lwp_coro_yield((void*)((intptr_t)v * 2));
+    v = lwp_coro_resume(inner, NULL);
+  }
+  lwp_coro_destroy(inner);
+  return (void*)(intptr_t)-2;
+}
+
+// an LWP that runs a generator and lwp_yields from inside it
+static long lwp_seen = 0;
+static void *yieldy(void *in){
+  (void)in;
+  for(int i=0;i<5;i++){ lwp_yield(); lwp_coro_yield((void*)(intptr_t)lwp_gettid()); }
+  return NULL;
+}
+static int user(void *p){
+  (void)p;
+  lwp_coro co = lwp_coro_create(yieldy, 0);
+  for(;;){
+    void *v = lwp_coro_resume(co, NULL);
+    if(lwp_coro_done(co)) break;
+    if((tid_t)(intptr_t)v == lwp_gettid()) lwp_seen++;
+    lwp_yield();
+  }
+  lwp_coro_destroy(co);
+  return 0;
+}
+
+int main(void){
+  lwp_coro g = lwp_coro_create(count, 0);
+  for(long i=0;i<1000;i++){
+    void *v = lwp_coro_resume(g, i == 0 ? (void*)1000 : NULL);
+    if((long)(intptr_t)v != i){ printf("generator gave %ld, want %ld\n", (long)(intptr_t)v, i); return 1; }
+  }
+  if((long)(intptr_t)lwp_coro_resume(g, NULL) != -1 || !lwp_coro_done(g)){ puts("no final value"); return 1; }
+  if(lwp_coro_resume(g, NULL) != NULL){ puts("resumed a finished coroutine"); return 1; }
+  lwp_coro_destroy(g);
+
+  lwp_coro s = lwp_coro_create(summer, 0);
+  long want = 0;
+  for(long i=1;i<=100;i++){
+    want += i;
+    if((long)(intptr_t)lwp_coro_resume(s, (void*)(intptr_t)i) != want){ puts("values not passed in"); return 1; }
+  }
+  lwp_coro_destroy(s);                   // suspended mid-loop: fine
+
+  lwp_coro d = lwp_coro_create(doubler, 0);
+  for(long i=0;i<10;i++)
+    if((long)(intptr_t)lwp_coro_resume(d, i == 0 ? (void*)10 : NULL) != 2 * i){ puts("nested coroutine wrong"); return 1; }
+  if((long)(intptr_t)lwp_coro_resume(d, NULL) != -2){ puts("nested final wrong"); return 1; }
+  lwp_coro_destroy(d);
+  if(lwp_coro_yield(NULL) != NULL){ puts("yield outside a coroutine"); return 1; }
+
+  // coroutines inside LWPs that keep being scheduled around
+  for(int i=0;i<3;i++) lwp_create(user, NULL);
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  if(lwp_seen != 15){ printf("coroutine saw its own LWP %ld/15 times\n", lwp_seen); return 1; }
+  puts("OK: coroutines");
+  return 0;
+}
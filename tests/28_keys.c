@@ -0,0 +1,57 @@
+// 28_keys.c
+#include <stdio.h>
+#include <stdint.h>
+#include "lwp.h"
+
+#define NKEYS 40                        // well past the inline slots
+
+static lwp_key_t keys[NKEYS];
+static long freed[NKEYS];
+static lwp_key_t again;                 // its destructor sets it again once
+static int again_runs = 0;
+
+static void dtor(void *v){
+  long k = (long)(intptr_t)v >> 16;
+  freed[k]++;
+}
+
+static void redo(void *v){
+  again_runs++;
+  if((intptr_t)v == 1) lwp_setspecific(again, (void*)2);
+}
+
+static int bad = 0;
+
+static int worker(void *p){
+  long id = (long)(intptr_t)p;
+  for(int k=0;k<NKEYS;k++){
+    if(lwp_getspecific(keys[k]) != NULL) bad++;
+    lwp_setspecific(keys[k], (void*)(intptr_t)(k << 16 | 0x100 | id));
+  }
+  lwp_setspecific(again, (void*)1);
+  lwp_yield();                          // others set the same keys meanwhile
+  for(int k=0;k<NKEYS;k++)
+    if(lwp_getspecific(keys[k]) != (void*)(intptr_t)(k << 16 | 0x100 | id)) bad++;
+  if(id == 0) lwp_setspecific(keys[5], NULL);   // no destructor for NULL
+  return 0;
+}
+
+int main(void){
+  for(int k=0;k<NKEYS;k++)
+    if(lwp_key_create(&keys[k], dtor)){ puts("key_create failed"); return 1; }
+  lwp_key_create(&again, redo);
+  if(lwp_setspecific(again + 1, (void*)1) == 0){ puts("set of a bad key worked"); return 1; }
+
+  for(long i=0;i<4;i++) lwp_create(worker, (void*)(intptr_t)i);
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  if(bad){ printf("%d wrong values\n", bad); return 1; }
+  for(int k=0;k<NKEYS;k++)
+    if(freed[k] != (k == 5 ? 3 : 4)){ printf("key %d: %ld destructor runs\n", k, freed[k]); return 1; }
+  if(again_runs != 8){ printf("re-set destructor ran %d times\n", again_runs); return 1; }
+
+  // the main thread has values of its own
+  lwp_setspecific(keys[NKEYS-1], (void*)7);
+  if(lwp_getspecific(keys[NKEYS-1]) != (void*)7){ puts("main value lost"); return 1; }
+  puts("OK: keys");
+  return 0;
+}
@@ -0,0 +1,131 @@
+// 29_inbox.c
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include "lwp.h"
+
+#define LWPS   8
+#define ROUNDS 200
+
+// a job queue served by one pthread
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cv = PTHREAD_COND_INITIALIZER;
+static tid_t jobs[LWPS + 1];
+static long  input[LWPS + 1], output[LWPS + 1];
+static int   njobs = 0, quit = 0;
+static volatile long tasks_run = 0;
+
+static void submit(int slot, tid_t tid){
+  pthread_mutex_lock(&mu);
+  jobs[njobs++] = tid | (tid_t)slot << 32;
+  pthread_cond_signal(&cv);
+  pthread_mutex_unlock(&mu);
+}
+
+static int task(void *p){
+  tasks_run += (long)p;
+  return 0;
+}
+
+static void *worker(void *p){
+  (void)p;
+  long served = 0;
+  pthread_mutex_lock(&mu);
+  for(;;){
+    while(!njobs && !quit) pthread_cond_wait(&cv, &mu);
+    if(!njobs) break;
+    tid_t j = jobs[--njobs];
+    pthread_mutex_unlock(&mu);
+    int slot = (int)(j >> 32);
+    output[slot] = input[slot] * 3;
+    if(++served % 50 == 0) lwp_post_task(task, (void*)1);
+    lwp_post_wakeup(j & 0xffffffff);
+    pthread_mutex_lock(&mu);
+  }
+  pthread_mutex_unlock(&mu);
+  return NULL;
+}
+
+// posts a wakeup to p after a millisecond
+static void *late(void *p){
+  struct timespec ms = { 0, 1000000 };
+  nanosleep(&ms, NULL);
+  lwp_post_wakeup((tid_t)p);
+  return NULL;
+}
+
+static int sleeper(void *p){
+  (void)p;
+  pthread_t pt;
+  pthread_create(&pt, NULL, late, (void*)lwp_gettid());
+  lwp_suspend();
+  pthread_join(pt, NULL);
+  return 7;
+}
+
+static int suspender(void *p){
+  (void)p;
+  lwp_suspend();
+  return 9;
+}
+
+static int bad = 0;
+static int client(void *p){
+  int slot = (int)(long)p;
+  for(long r=1;r<=ROUNDS;r++){
+    input[slot] = r;
+    output[slot] = 0;
+    submit(slot, lwp_gettid());
+    lwp_suspend();
+    if(output[slot] != 3 * r) bad++;
+  }
+  return 0;
+}
+
+int main(void){
+  pthread_t pt;
+  pthread_create(&pt, NULL, worker, NULL);
+
+  for(long i=0;i<LWPS;i++) lwp_create(client, (void*)i);
+  while(lwp_wait(NULL) != NO_THREAD) ;
+  if(bad){ printf("%d jobs came back wrong\n", bad); return 1; }
+
+  // main itself waits for a post, with nothing else to run
+  input[LWPS] = 14;
+  submit(LWPS, lwp_gettid());
+  lwp_suspend();
+  if(output[LWPS] != 42){ puts("main not woken with its result"); return 1; }
+
+  // a wakeup before the suspend isn't lost
+  lwp_post_wakeup(lwp_gettid());
+  lwp_suspend();
+
+  pthread_mutex_lock(&mu);
+  quit = 1;
+  pthread_cond_signal(&cv);
+  pthread_mutex_unlock(&mu);
+  pthread_join(pt, NULL);
+
+  while(tasks_run < LWPS * ROUNDS / 50) lwp_yield();
+
+  // main's yield returns with its only LWP suspended: main wakes it
+  tid_t s = lwp_create(suspender, NULL);
+  lwp_yield();
+  lwp_yield();
+  lwp_post_wakeup(s);
+  int st;
+  if(lwp_wait(&st) != s || LWPTERMSTAT(st) != 9){ puts("suspender not woken"); return 1; }
+
+  // lwp_wait() with its only LWP suspended idles per the policy
+  static const int policy[] = { LWP_IDLE_SPIN, LWP_IDLE_SPIN_PARK, LWP_IDLE_PARK };
+  for(int i=0;i<3;i++){
+    lwp_set_idle(policy[i], 100);
+    for(int j=0;j<20;j++){
+      int st;
+      lwp_create(sleeper, NULL);
+      if(lwp_wait(&st) == NO_THREAD || LWPTERMSTAT(st) != 7){ printf("policy %d: wait failed\n", policy[i]); return 1; }
+    }
+  }
+  printf("OK: inbox (%ld posted tasks)\n", tasks_run);
+  return 0;
+}
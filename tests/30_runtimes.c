@@ -0,0 +1,84 @@
+// 30_runtimes.c
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "lwp.h"
+
+#define PTHREADS 4
+#define LWPS     8
+#define YIELDS   2000
+
+static int yielder(void *p){
+  for(long i=0;i<(long)(intptr_t)p;i++) lwp_yield();
+  return 3;
+}
+
+static void *twice(void *p){ return (void*)((intptr_t)p * 2); }
+
+static tid_t sleepers[PTHREADS];
+static volatile int ready[PTHREADS];
+
+static int sleeper(void *p){
+  int i = (int)(intptr_t)p;
+  sleepers[i] = lwp_gettid();
+  __atomic_store_n(&ready[i], 1, __ATOMIC_RELEASE);
+  lwp_suspend();
+  return 5;
+}
+
+// one pthread, one runtime: LWPs, futures, a wakeup from a neighbour
+static void *host(void *p){
+  int me = (int)(intptr_t)p;
+  long bad = 0;
+  lwp_runtime *rt = lwp_runtime_create();
+  if(!rt) return (void*)1;
+  lwp_runtime_bind(rt);
+  if(lwp_runtime_current() != rt) bad++;
+
+  tid_t first = lwp_create(sleeper, (void*)(intptr_t)me);
+  for(int i=0;i<LWPS;i++) lwp_create(yielder, (void*)(intptr_t)YIELDS);
+  lwp_future f = lwp_spawn(twice, (void*)(intptr_t)(me + 1));
+
+  // wake the next pthread's sleeper once it is there
+  int next = (me + 1) % PTHREADS;
+  while(!__atomic_load_n(&ready[next], __ATOMIC_ACQUIRE)) lwp_yield();
+  lwp_post_wakeup(sleepers[next]);
+
+  if((intptr_t)lwp_await(f) != 2 * (me + 1)) bad++;
+  int st, n = 0;
+  tid_t t;
+  while((t = lwp_wait(&st)) != NO_THREAD){
+    n++;
+    if(t == first ? LWPTERMSTAT(st) != 5 : LWPTERMSTAT(st) != 3) bad++;
+    if(tid2thread(t)) bad++;                   // reaped
+  }
+  if(n != LWPS + 1) bad++;
+  if(lwp_runtime_destroy(rt) == 0) bad++;      // still bound
+  lwp_runtime_bind(NULL);
+  if(lwp_runtime_destroy(rt)) bad++;
+  return (void*)bad;
+}
+
+int main(void){
+  lwp_runtime *def = lwp_runtime_current();
+  tid_t mine = lwp_create(yielder, (void*)10);  // default runtime, untouched
+
+  pthread_t pt[PTHREADS];
+  for(long i=0;i<PTHREADS;i++) pthread_create(&pt[i], NULL, host, (void*)i);
+  long bad = 0;
+  for(int i=0;i<PTHREADS;i++){
+    void *r;
+    pthread_join(pt[i], &r);
+    bad += (long)r;
+  }
+  if(bad){ printf("%ld failures in the runtimes\n", bad); return 1; }
+
+  for(int i=0;i<PTHREADS;i++)
+    for(int j=0;j<i;j++)
+      if(sleepers[i] == sleepers[j]){ puts("tids collide across runtimes"); return 1; }
+  if(lwp_runtime_current() != def){ puts("main's binding changed"); return 1; }
+  if(lwp_runtime_destroy(def) == 0){ puts("destroyed the default"); return 1; }
+  if(lwp_wait(NULL) != mine || lwp_wait(NULL) != NO_THREAD){ puts("default runtime disturbed"); return 1; }
+  puts("OK: runtimes");
+  return 0;
+}
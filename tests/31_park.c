@@ -0,0 +1,123 @@
+// 31_park.c
+#include <stdio.h>
+#include "lwp.h"
+
+#define LWPS   64
+#define ROUNDS 100
+#define WORDS  100000
+
+// a three-state mutex (0 free, 1 held, 2 held with waiters) on the lot
+static int mu = 0;
+static long counter = 0;
+static int inside = 0, overlap = 0;
+
+static void lock(int *m){
+  int c = __sync_val_compare_and_swap(m, 0, 1);
+  if(c == 0) return;
+  if(c != 2) c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    lwp_park(m, 2);
+    c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+static void unlock(int *m){
+  if(__atomic_fetch_sub(m, 1, __ATOMIC_RELEASE) != 1){
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+    lwp_unpark_one(m);
+  }
+}
+
+static int contender(void *p){
+  (void)p;
+  for(int i=0;i<ROUNDS;i++){
+    lock(&mu);
+    if(inside++) overlap++;
+    lwp_yield();                 // hold it across a switch
+    counter++;
+    inside--;
+    unlock(&mu);
+  }
+  return 0;
+}
+
+// each waiter parks on a word of its own, or on shared[0]
+static int words[WORDS];
+static int order[8], norder = 0;
+
+static int word_waiter(void *p){
+  long i = (long)p;
+  if(lwp_park(&words[i], 0) != 0) return 1;
+  return words[i] == 1 ? 0 : 2;
+}
+
+static int fifo_waiter(void *p){
+  if(lwp_park(&words[0], 7) != 0) return 1;
+  order[norder++] = (int)(long)p;
+  return 0;
+}
+
+// on the shared stack all parkers sit at the same addresses
+static int gate = 0, passed = 0;
+static int shared_parker(void *p){
+  (void)p;
+  while(!gate) lwp_park(&gate, 0);
+  passed++;
+  return 0;
+}
+
+static int reap(int n){
+  int st, bad = 0;
+  for(int i=0;i<n;i++){
+    if(lwp_wait(&st) == NO_THREAD) return 1;
+    if(LWPTERMSTAT(st)) bad++;
+  }
+  return bad;
+}
+
+int main(void){
+  int v = 5;
+  if(lwp_park(&v, 4) != 1){ puts("parked on a changed value"); return 1; }
+  if(lwp_park(&v, 5) != -1){ puts("parked with nothing to wake it"); return 1; }
+  if(lwp_unpark_all(&v) != 0){ puts("woke a ghost"); return 1; }
+
+  for(long i=0;i<LWPS;i++) lwp_create(contender, NULL);
+  if(reap(LWPS)){ puts("contender failed"); return 1; }
+  if(overlap || counter != (long)LWPS * ROUNDS || mu){
+    printf("mutex broken: overlap %d counter %ld word %d\n", overlap, counter, mu);
+    return 1;
+  }
+
+  // waiters spread over the words, so over every bucket
+  const long stride = WORDS / 1000;
+  for(long i=0;i<WORDS;i+=stride) lwp_create(word_waiter, (void*)i);
+  lwp_yield();                                  // let them all park
+  size_t woke = 0;
+  for(long i=WORDS-stride;i>=0;i-=stride){
+    if(lwp_unpark_one(&words[i + 1]) != 0){ puts("woke a neighbour"); return 1; }
+    words[i] = 1;
+    woke += lwp_unpark_one(&words[i]);
+  }
+  if(woke != WORDS / stride){ printf("woke %zu of %ld\n", woke, WORDS / stride); return 1; }
+  if(reap(WORDS / stride)){ puts("word waiter failed"); return 1; }
+
+  words[0] = 7;
+  for(long i=0;i<8;i++) lwp_create(fifo_waiter, (void*)i);
+  lwp_yield();
+  if(lwp_unpark_one(&words[0]) != 1){ puts("unpark_one"); return 1; }
+  if(lwp_unpark_all(&words[0]) != 7){ puts("unpark_all"); return 1; }
+  if(reap(8)){ puts("fifo waiter failed"); return 1; }
+  for(int i=0;i<8;i++)
+    if(order[i] != i){ puts("not woken in parking order"); return 1; }
+
+  lwp_attr sh = { LWP_ATTR_SHARED_STACK, 0 };
+  for(int i=0;i<3;i++) lwp_create_attr(shared_parker, NULL, &sh);
+  lwp_yield();
+  lwp_yield();                                  // all parked: main just goes on
+  gate = 1;
+  if(lwp_unpark_all(&gate) != 3){ puts("shared-stack parkers lost"); return 1; }
+  if(reap(3) || passed != 3){ puts("shared-stack parker failed"); return 1; }
+
+  puts("OK: park");
+  return 0;
+}
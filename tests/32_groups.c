@@ -0,0 +1,82 @@
+// 32_groups.c
+#include <stdio.h>
+#include "lwp.h"
+
+#define GROUPS  3
+#define MEMBERS 3
+#define ROUNDS  50
+
+static int log_[2 * GROUPS * MEMBERS * ROUNDS], nlog = 0;
+
+// logs its group each time it runs
+static int member(void *p){
+  (void)p;
+  unsigned g = lwp_get_group(lwp_gettid());
+  for(int r=0;r<ROUNDS;r++){
+    log_[nlog++] = (int)g;
+    lwp_yield();
+  }
+  return 0;
+}
+
+static int child(void *p){
+  (void)p;
+  return (int)lwp_get_group(lwp_gettid());
+}
+
+static int parent(void *p){
+  (void)p;
+  tid_t c = lwp_create(child, NULL);
+  int st;
+  if(lwp_wait(&st) != c) return 1;
+  return LWPTERMSTAT(st);
+}
+
+static int reap(int n){
+  int st, bad = 0;
+  for(int i=0;i<n;i++){
+    if(lwp_wait(&st) == NO_THREAD) return 1;
+    if(LWPTERMSTAT(st)) bad++;
+  }
+  return bad;
+}
+
+int main(void){
+  lwp_set_scheduler(lwp_group_scheduler());
+  if(lwp_set_group(12345, 1) != -1){ puts("grouped a bad tid"); return 1; }
+
+  // created interleaved, so plain RR would alternate groups
+  for(int m=0;m<MEMBERS;m++)
+    for(int g=1;g<=GROUPS;g++)
+      if(lwp_set_group(lwp_create(member, NULL), (unsigned)g)){ puts("set_group"); return 1; }
+  if(reap(GROUPS * MEMBERS)){ puts("member failed"); return 1; }
+  if(nlog != GROUPS * MEMBERS * ROUNDS){ printf("ran %d times\n", nlog); return 1; }
+  for(int i=0;i<nlog;i+=MEMBERS){
+    int want = i / MEMBERS % GROUPS + 1;
+    for(int j=0;j<MEMBERS;j++)
+      if(log_[i + j] != want){ printf("entry %d: group %d, want %d\n", i + j, log_[i + j], want); return 1; }
+  }
+
+  // a lone thread still runs once per round next to a big group
+  nlog = 0;
+  tid_t lone = lwp_create(member, NULL);
+  lwp_set_group(lone, 9);
+  for(int i=0;i<2 * GROUPS * MEMBERS - 1;i++) lwp_set_group(lwp_create(member, NULL), 4);
+  if(reap(2 * GROUPS * MEMBERS)){ puts("member failed"); return 1; }
+  int last = -1;
+  for(int i=0;i<nlog;i++){
+    if(log_[i] != 9) continue;
+    if(last >= 0 && i - last != 2 * GROUPS * MEMBERS){ printf("lone thread waited %d\n", i - last); return 1; }
+    last = i;
+  }
+  if(last < 0){ puts("lone thread starved"); return 1; }
+
+  // children start in their creator's group
+  tid_t p = lwp_create(parent, NULL);
+  lwp_set_group(p, 7);
+  int st;
+  if(lwp_wait(&st) != p || LWPTERMSTAT(st) != 7){ printf("child in group %d\n", LWPTERMSTAT(st)); return 1; }
+
+  puts("OK: groups");
+  return 0;
+}
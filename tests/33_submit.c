@@ -0,0 +1,115 @@
+// 33_submit.c
+#include <stdio.h>
+#include <string.h>
+#include "lwp.h"
+
+#define TASKS 10000
+
+static long order[TASKS], norder = 0;
+static char trail[16];
+static int  ntrail = 0, word = 0;
+
+static int count(void *p){
+  order[norder++] = (long)p;
+  return 0;
+}
+
+static int mark(void *p){
+  trail[ntrail++] = (char)(long)p;
+  return 0;
+}
+
+// yields half way: promoted, the rest of the queue runs meanwhile
+static int yielder(void *p){
+  (void)p;
+  trail[ntrail++] = 'a';
+  lwp_yield();
+  trail[ntrail++] = 'A';
+  return 0;
+}
+
+static int parker(void *p){
+  (void)p;
+  while(!word) lwp_park(&word, 0);
+  trail[ntrail++] = 'P';
+  return 0;
+}
+
+static int unparker(void *p){
+  (void)p;
+  word = 1;
+  lwp_unpark_all(&word);
+  trail[ntrail++] = 'u';
+  return 0;
+}
+
+static int quitter(void *p){
+  (void)p;
+  trail[ntrail++] = 'q';
+  lwp_exit(0);
+  return 1;
+}
+
+static int nester(void *p){
+  (void)p;
+  lwp_submit(mark, (void*)'n');
+  trail[ntrail++] = 'N';
+  return 0;
+}
+
+static lwp_key_t key;
+static int dtors = 0, stale = 0;
+
+static void dtor(void *v){ (void)v; dtors++; }
+
+// each task finds the key empty, whatever the one before it left there
+static int keyed(void *p){
+  if(lwp_getspecific(key)) stale++;
+  lwp_setspecific(key, p);
+  return 0;
+}
+
+static int pos(char c){
+  char *p = strchr(trail, c);
+  return p ? (int)(p - trail) : -1;
+}
+
+static int drained(void){
+  return lwp_wait(NULL) == NO_THREAD;        // dispatchers are detached
+}
+
+int main(void){
+  if(lwp_submit(NULL, NULL) != -1){ puts("took a NULL task"); return 1; }
+  for(long i=0;i<TASKS;i++)
+    if(lwp_submit(count, (void*)i)){ puts("submit failed"); return 1; }
+  if(!drained() || norder != TASKS){ printf("ran %ld of %d\n", norder, TASKS); return 1; }
+  for(long i=0;i<TASKS;i++)
+    if(order[i] != i){ puts("not run in order"); return 1; }
+
+  lwp_submit(yielder, NULL);
+  lwp_submit(mark, (void*)'b');
+  lwp_submit(parker, NULL);
+  lwp_submit(quitter, NULL);
+  lwp_submit(mark, (void*)'c');
+  lwp_submit(nester, NULL);
+  lwp_submit(unparker, NULL);
+  if(!drained()){ puts("left something behind"); return 1; }
+  trail[ntrail] = 0;
+  // each task ran once; blocked ones finished after the queue moved on
+  if(ntrail != 9 || strspn(trail, "abPqcNnuA") != 9 || trail[0] != 'a'
+     || pos('A') < pos('b') || pos('P') < pos('u') || pos('n') < pos('N')
+     || pos('c') < pos('q')){
+    printf("trail %s\n", trail);
+    return 1;
+  }
+
+  if(lwp_key_create(&key, dtor)){ puts("no key"); return 1; }
+  for(long i=1;i<=3;i++) lwp_submit(keyed, (void*)i);
+  if(!drained() || stale || dtors != 3){
+    printf("keys leaked between tasks: stale %d, dtors %d\n", stale, dtors);
+    return 1;
+  }
+
+  puts("OK: submit");
+  return 0;
+}
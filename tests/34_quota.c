@@ -0,0 +1,89 @@
+// 34_quota.c
+#include <stdio.h>
+#include <time.h>
+#include "lwp.h"
+
+#define RUN_MS 400
+
+static double now_ms(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double t_end;
+
+// burns the CPU a millisecond at a time until t_end
+static int spinner(void *p){
+  (void)p;
+  while(now_ms() < t_end){
+    double until = now_ms() + 1;
+    while(now_ms() < until) ;
+    lwp_yield();
+  }
+  return 0;
+}
+
+static int reap(int n){
+  int st, bad = 0;
+  for(int i=0;i<n;i++){
+    if(lwp_wait(&st) == NO_THREAD) return 1;
+    if(LWPTERMSTAT(st)) bad++;
+  }
+  return bad;
+}
+
+static double share(unsigned gid, double wall){
+  lwp_group_stats st;
+  if(lwp_group_usage(gid, &st)) return -1;
+  return st.usage_ns / 1e6 / wall;
+}
+
+// a capped group and an uncapped one, each with two spinners
+static int capped_vs_free(unsigned capped, unsigned free_){
+  for(int i=0;i<2;i++){
+    lwp_set_group(lwp_create(spinner, NULL), capped);
+    lwp_set_group(lwp_create(spinner, NULL), free_);
+  }
+  double t0 = now_ms();
+  t_end = t0 + RUN_MS;
+  if(reap(4)) return 1;
+  double wall = now_ms() - t0;
+  double c = share(capped, wall), f = share(free_, wall);
+  lwp_group_stats st;
+  lwp_group_usage(capped, &st);
+  if(c < 0.1 || c > 0.35 || f < 0.6 || !st.throttles || st.held){
+    printf("capped %.2f free %.2f throttles %lu held %lu\n", c, f, st.throttles, st.held);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void){
+  if(lwp_group_quota(1, 200, 100) != -1){ puts("budget over period"); return 1; }
+  if(lwp_group_quota(1, 20, 0) != -1){ puts("no period"); return 1; }
+  lwp_group_stats st;
+  if(lwp_group_usage(99, &st) != -1){ puts("stats for a ghost group"); return 1; }
+
+  if(lwp_group_quota(1, 20000, 100000)){ puts("quota"); return 1; }
+  if(capped_vs_free(1, 2)){ puts("RR: quota not enforced"); return 1; }
+
+  // alone, a capped group still only gets its share: the rest is idle
+  tid_t t = lwp_create(spinner, NULL);
+  lwp_set_group(t, 3);
+  lwp_group_quota(3, 10000, 50000);
+  double t0 = now_ms();
+  t_end = t0 + RUN_MS;
+  if(reap(1)){ puts("lone spinner"); return 1; }
+  double c = share(3, now_ms() - t0);
+  if(c < 0.1 || c > 0.35){ printf("lone capped group got %.2f\n", c); return 1; }
+  lwp_group_quota(3, 0, 0);
+
+  // same again under another scheduler
+  lwp_set_scheduler(lwp_group_scheduler());
+  lwp_group_quota(4, 20000, 100000);
+  if(capped_vs_free(4, 5)){ puts("group scheduler: quota not enforced"); return 1; }
+
+  puts("OK: quota");
+  return 0;
+}
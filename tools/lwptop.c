@@ -0,0 +1,120 @@
+// lwptop: live view of a process's LWPs via its stats segment
+//
+//   % ./tools/lwptop [-n iterations] [-d delay_ms] <pid | /shm-name>
+//
+// The target must have called lwp_stats_publish().  We map the segment
+// read-only, so watching never slows down or stops the process.
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "lwp.h"
+
+static const char *state_name[] = { "-", "ready", "RUN", "exited" };
+
+// Take a consistent copy of the segment (seqlock read side)
+static void snapshot(const lwp_stats_seg *seg, lwp_stats_seg *out){
+  for (;;){
+    unsigned long s1 = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+    if (s1 & 1) continue;
+    memcpy(out, seg, sizeof *out);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == s1) return;
+  }
+}
+
+typedef struct { unsigned long slot, tid, state, dsw, drun, total; } row;
+
+static int by_cpu(const void *a, const void *b){
+  const row *x = a, *y = b;
+  if (x->drun != y->drun) return x->drun < y->drun ? 1 : -1;
+  return x->dsw < y->dsw ? 1 : (x->dsw > y->dsw ? -1 : 0);
+}
+
+static void msleep(long ms){
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+int main(int argc, char *argv[]){
+  long iters = -1, delay = 1000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:")) != -1){
+    switch (opt){
+    case 'n': iters = atol(optarg); break;
+    case 'd': delay = atol(optarg); break;
+    default:  goto usage;
+    }
+  }
+  if (optind != argc - 1) goto usage;
+
+  char name[64];
+  if (argv[optind][0] == '/') snprintf(name, sizeof name, "%s", argv[optind]);
+  else snprintf(name, sizeof name, "/lwp-%s", argv[optind]);
+
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0){ perror(name); return 1; }
+  const lwp_stats_seg *seg = mmap(NULL, sizeof *seg, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (seg == MAP_FAILED){ perror("mmap"); return 1; }
+  if (seg->magic != LWP_STATS_MAGIC || seg->version != LWP_STATS_VERSION){
+    fprintf(stderr, "%s: not an lwp stats segment\n", name);
+    return 1;
+  }
+
+  lwp_stats_seg *prev = malloc(sizeof *prev), *cur = malloc(sizeof *cur);
+  row *rows = malloc(LWP_STATS_SLOTS * sizeof *rows);
+  if (!prev || !cur || !rows) return 1;
+  snapshot(seg, prev);
+  int tty = isatty(STDOUT_FILENO);
+
+  for (long it = 0; iters < 0 || it < iters; it++){
+    msleep(delay);
+    snapshot(seg, cur);
+
+    double secs = delay / 1000.0;
+    unsigned long wall = cur->tsc > prev->tsc ? cur->tsc - prev->tsc : 1;
+
+    int n = 0;
+    for (unsigned long i = 0; i < cur->nslots; i++){
+      const lwp_stats_thr *c = &cur->thr[i], *p = &prev->thr[i];
+      if (c->state == LWP_ST_FREE) continue;
+      int same = p->tid == c->tid;
+      rows[n].slot  = i;
+      rows[n].tid   = c->tid;
+      rows[n].state = c->state;
+      rows[n].dsw   = c->switches - (same ? p->switches : 0);
+      rows[n].drun  = c->run_tsc  - (same ? p->run_tsc  : 0);
+      rows[n].total = c->switches;
+      n++;
+    }
+    qsort(rows, n, sizeof *rows, by_cpu);
+
+    if (tty) printf("\033[H\033[2J");
+    printf("lwptop - pid %lu  live %lu  qlen %lu  switches %lu (%.0f/s)"
+           "  reaped %lu\n",
+           cur->pid, cur->creates - cur->exits, cur->qlen, cur->switches,
+           (cur->switches - prev->switches) / secs, cur->reaps);
+    if (cur->overflow)
+      printf("(%lu threads not shown: slot table full)\n", cur->overflow);
+    printf("%10s %-7s %10s %6s %12s\n", "TID", "STATE", "SW/s", "CPU%", "SWITCHES");
+    for (int i = 0; i < n && i < 40; i++){
+      printf("%10lu %-7s %10.0f %5.1f%% %12lu\n",
+             rows[i].tid, state_name[rows[i].state & 3],
+             rows[i].dsw / secs, 100.0 * (double)rows[i].drun / (double)wall,
+             rows[i].total);
+    }
+    fflush(stdout);
+
+    lwp_stats_seg *t = prev; prev = cur; cur = t;
+  }
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-n iterations] [-d delay_ms] <pid | /shm-name>\n",
+          argv[0]);
+  return 2;
+}
@@ -0,0 +1,88 @@
+// lwptrace2json: convert an lwp_trace_save() file to Chrome trace JSON
+//
+//   % ./tools/lwptrace2json trace.bin > trace.json
+//
+// Load the result in chrome://tracing or ui.perfetto.dev.  Each LWP is
+// a track; the time it spends on the CPU shows up as a "run" slice.
+#include <stdio.h>
+#include <string.h>
+#include "lwp.h"
+
+static double us(unsigned long tsc, unsigned long base, double hz){
+  return (double)(tsc - base) * 1e6 / hz;
+}
+
+static void instant(FILE *out, int *first, const char *name,
+                    unsigned long tid, double ts,
+                    const char *k1, unsigned long v1){
+  fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,"
+          "\"tid\":%lu,\"ts\":%.3f,\"args\":{\"%s\":%lu}}",
+          *first ? "" : ",", name, tid, ts, k1, v1);
+  *first = 0;
+}
+
+static void slice(FILE *out, int *first, char ph, unsigned long tid, double ts){
+  fprintf(out, "%s\n{\"name\":\"run\",\"ph\":\"%c\",\"pid\":1,"
+          "\"tid\":%lu,\"ts\":%.3f}",
+          *first ? "" : ",", ph, tid, ts);
+  *first = 0;
+}
+
+int main(int argc, char *argv[]){
+  if (argc != 2){
+    fprintf(stderr, "usage: %s trace.bin > trace.json\n", argv[0]);
+    return 2;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (!in){ perror(argv[1]); return 1; }
+
+  lwp_trace_hdr hdr;
+  if (fread(&hdr, sizeof hdr, 1, in) != 1 ||
+      memcmp(hdr.magic, LWP_TRACE_MAGIC, sizeof hdr.magic)){
+    fprintf(stderr, "%s: not an lwp trace\n", argv[1]);
+    return 1;
+  }
+  if (hdr.tsc_hz <= 0.0) hdr.tsc_hz = 1e9;
+  if (hdr.dropped)
+    fprintf(stderr, "note: %lu older events were overwritten\n", hdr.dropped);
+
+  FILE *out = stdout;
+  int first = 1;
+  unsigned long base = 0, running = NO_THREAD;
+  double ts = 0.0;
+  lwp_trace_ev e;
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (unsigned long i = 0; i < hdr.count; i++){
+    if (fread(&e, sizeof e, 1, in) != 1) break;
+    if (i == 0) base = e.tsc;
+    ts = us(e.tsc, base, hdr.tsc_hz);
+
+    switch (e.type){
+    case LWP_EV_SWITCH:
+      if (running == e.a) slice(out, &first, 'E', e.a, ts);
+      slice(out, &first, 'B', e.b, ts);
+      running = e.b;
+      break;
+    case LWP_EV_CREATE:
+      instant(out, &first, "create", e.b, ts, "child", e.a);
+      break;
+    case LWP_EV_EXIT:
+      instant(out, &first, "exit", e.a, ts, "status", e.b);
+      break;
+    case LWP_EV_WAIT:
+      instant(out, &first, "reap", e.a, ts, "reaped", e.b);
+      break;
+    case LWP_EV_SCHED:
+      instant(out, &first, "set_scheduler", running, ts, "new", e.b);
+      break;
+    default:
+      break;
+    }
+  }
+  if (running != NO_THREAD) slice(out, &first, 'E', running, ts);
+  fprintf(out, "\n]}\n");
+
+  fclose(in);
+  return 0;
+}
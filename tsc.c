@@ -0,0 +1,28 @@
+#include "tsc.h"
+#include <time.h>
+
+static double hz = 0.0;
+
+static unsigned long mono_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+// Calibrate over ~10ms; only ever done on the reporting path
+double tsc_hz(void){
+  if (hz > 0.0) return hz;
+
+  struct timespec nap = { 0, 10 * 1000 * 1000 };
+  unsigned long n0 = mono_ns(), t0 = tsc_now();
+  nanosleep(&nap, NULL);
+  unsigned long n1 = mono_ns(), t1 = tsc_now();
+
+  if (n1 <= n0 || t1 <= t0) return hz = 1e9;   // treat ticks as ns
+  hz = (double)(t1 - t0) * 1e9 / (double)(n1 - n0);
+  return hz;
+}
+
+unsigned long tsc_to_ns(unsigned long ticks){
+  return (unsigned long)((double)ticks * 1e9 / tsc_hz());
+}
@@ -0,0 +1,26 @@
+#ifndef TSCH
+#define TSCH
+
+#include <stdint.h>
+
+/* Cheap timestamps for the instrumentation paths.  rdtsc is not
+ * serializing, which is fine: we only want ordering to within a few
+ * cycles, not exact instruction boundaries.
+ */
+#if defined(__x86_64)
+static inline unsigned long tsc_now(void){
+  uint32_t lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((unsigned long)hi << 32) | lo;
+}
+#else
+  #error "This only works on x86_64 for now"
+#endif
+
+// TSC ticks per second, calibrated once against CLOCK_MONOTONIC
+extern double tsc_hz(void);
+
+// convert a tick count to nanoseconds
+extern unsigned long tsc_to_ns(unsigned long ticks);
+
+#endif